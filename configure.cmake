@@ -24,13 +24,40 @@ endif()
 #
 # Configure compilers
 #
+option(ART_ENABLE_AVX2 "Target AVX2 - ray packets use 8 lanes instead of 4" OFF)
+option(ART_MATERIAL_VARIANT "Store materials as a std::variant instead of dispatching through a vtable" OFF)
+option(ART_SCALAR_VEC3 "Store vec3T_t<float> as three floats instead of in an SSE register" OFF)
+option(ART_STATS "Count rays, intersection tests, scatters and path lengths and report them after rendering" OFF)
+
+if(ART_MATERIAL_VARIANT)
+  add_compile_definitions(ART_MATERIAL_VARIANT=1)
+endif()
+
+if(ART_SCALAR_VEC3)
+  add_compile_definitions(ART_SCALAR_VEC3=1)
+endif()
+
+if(ART_STATS)
+  add_compile_definitions(ART_STATS=1)
+endif()
+
 if(MSVC)
   add_compile_options(/Zc:wchar_t-) # wchar_t is a built-in type.
   add_compile_options(/W4 /WX) # warning level 4 and warnings are errors.
   add_compile_options(/Zi) # enable debugging information.
 
   add_link_options(/DEBUG) # enable debugging information.
+
+  if(ART_ENABLE_AVX2)
+    add_compile_options(/arch:AVX2)
+  endif()
 else()
   add_compile_options(-Wall -Werror) # All warnings and are errors.
   add_compile_options(-g) # enable debugging information.
+  add_compile_options(-fno-math-errno) # sqrt() in packet kernels can be vectorized.
+  add_compile_options(-fno-trapping-math) # Selects on floats, e.g. in the denoiser's weights, can be vectorized.
+
+  if(ART_ENABLE_AVX2)
+    add_compile_options(-mavx2)
+  endif()
 endif()
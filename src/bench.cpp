@@ -0,0 +1,738 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <vec3.hpp>
+#include <ray.hpp>
+#include <aabb.hpp>
+#include <elements.hpp>
+#include <shapes.hpp>
+#include <scene.hpp>
+#include <scenes.hpp>
+#include <bvh.hpp>
+#include <sphere_bvh.hpp>
+#include <mesh.hpp>
+#include <camera.hpp>
+#include <integrator.hpp>
+#include <sampler.hpp>
+#include <scheduler.hpp>
+#include <accumulation.hpp>
+#include <denoise.hpp>
+#include <utility.hpp>
+
+#ifdef BUILD_WINDOWS
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif // BUILD_WINDOWS
+
+namespace
+{
+    // Type aliases
+    using elem_t = float;
+    using vec3_t = vec3T_t<elem_t>;
+    using point3_t = point3T_t<elem_t>;
+    using ray_t = rayT_t<elem_t>;
+    using aabb_t = aabbT_t<elem_t>;
+    using box_ray_t = box_rayT_t<elem_t>;
+    using triangle_ray_t = triangle_rayT_t<elem_t>;
+    using sphere_t = sphereT_t<elem_t>;
+    using hittable_t = hittableT_t<elem_t>;
+    using scene_t = sceneT_t<elem_t>;
+    using sphere_soa_t = sphere_soaT_t<elem_t>;
+    using bvh_t = bvhT_t<elem_t>;
+    using camera_t = cameraT_t<elem_t>;
+    using path_settings_t = path_settingsT_t<elem_t>;
+    using accumulation_buffer_t = accumulation_bufferT_t<elem_t>;
+    using feature_buffer_t = feature_bufferT_t<elem_t>;
+    using surface_features_t = surface_featuresT_t<elem_t>;
+    using bench_clock_t = std::chrono::steady_clock;
+
+    // Number of primitives and rays in each micro-benchmark.
+    // The primitives fit in L1/L2 so the kernels, not memory, are measured.
+    int32_t const primitive_count = 256;
+    int32_t const ray_count = 4096;
+    int32_t const repeat_count = 16;
+
+    // Size of the sphere scenes for closest-hit queries
+    int32_t const scene_sphere_count = 1024;
+
+    // Size of the images rendered to compare path settings
+    int32_t const convergence_width = 120;
+    int32_t const convergence_height = 80;
+    int32_t const convergence_samples = 32;
+
+    // Prevents the compiler from discarding results.
+    uint64_t volatile g_sink;
+
+    point3_t random_point(rng_t& rng, elem_t min, elem_t max)
+    {
+        return { random_value<elem_t>(rng, min, max), random_value<elem_t>(rng, min, max), random_value<elem_t>(rng, min, max) };
+    }
+
+    std::vector<ray_t> random_rays(rng_t& rng)
+    {
+        std::vector<ray_t> rays;
+        rays.reserve(ray_count);
+        for (int32_t i = 0; i < ray_count; ++i)
+            rays.push_back({ random_point(rng, -20, 20), random_point(rng, -1, 1) });
+        return rays;
+    }
+
+    void report(char const* name, uint64_t tests, bench_clock_t::duration elapsed)
+    {
+        double const seconds = std::chrono::duration<double>(elapsed).count();
+        std::printf("%-12s %10.2f M tests/s  %8.3f ns/test\n",
+            name,
+            tests / seconds * 1e-6,
+            seconds * 1e9 / tests);
+    }
+
+    // Read on every repetition so the compiler cannot hoist the operations out of the loop.
+    int32_t volatile g_vec_offset = 0;
+
+    // Time 'op(i, j)' over every index of the operand arrays. 'i' is the output
+    // index and 'j' the operand index. 'count' must be a power of two.
+    template<typename OP>
+    void bench_vec_op(char const* name, int32_t count, OP&& op)
+    {
+        int32_t const repeats = repeat_count * 16;
+        auto start = bench_clock_t::now();
+        for (int32_t n = 0; n < repeats; ++n)
+        {
+            int32_t const offset = g_vec_offset;
+            for (int32_t i = 0; i < count; ++i)
+                op(i, (i + offset) & (count - 1));
+        }
+        auto elapsed = bench_clock_t::now() - start;
+        report(name, uint64_t(repeats) * count, elapsed);
+    }
+
+    // Throughput of the vec3 operations the camera, materials and shapes use.
+    // Build with ART_SCALAR_VEC3 to compare against three-float storage.
+    void bench_vec_ops(rng_t& rng)
+    {
+#ifdef ART_VEC3_SSE
+        std::printf("vec3 storage: SSE register\n");
+#else
+        std::printf("vec3 storage: %zu bytes\n", sizeof(vec3_t));
+#endif // ART_VEC3_SSE
+
+        std::vector<vec3_t> a;
+        std::vector<vec3_t> b;
+        for (int32_t i = 0; i < ray_count; ++i)
+        {
+            a.push_back(random_point(rng, -1, 1));
+            b.push_back(random_point(rng, -1, 1));
+        }
+
+        std::vector<vec3_t> out(ray_count);
+        std::vector<elem_t> dots(ray_count);
+        bench_vec_op("vec a+t*b", ray_count, [&](int32_t i, int32_t j) { out[i] = a[j] + elem_t(0.5) * b[j]; });
+        bench_vec_op("vec a*b", ray_count, [&](int32_t i, int32_t j) { out[i] = a[j] * b[j]; });
+        bench_vec_op("vec dot", ray_count, [&](int32_t i, int32_t j) { dots[i] = dot(a[j], b[j]); });
+        bench_vec_op("vec cross", ray_count, [&](int32_t i, int32_t j) { out[i] = cross(a[j], b[j]); });
+        bench_vec_op("vec unit", ray_count, [&](int32_t i, int32_t j) { out[i] = unit_vector(a[j]); });
+
+        elem_t sum = 0;
+        for (int32_t i = 0; i < ray_count; ++i)
+            sum += out[i].x() + dots[i];
+        g_sink = static_cast<uint64_t>(sum);
+    }
+
+    void bench_ray_box(std::vector<ray_t> const& rays, rng_t& rng)
+    {
+        std::vector<aabb_t> boxes;
+        for (int32_t i = 0; i < primitive_count; ++i)
+        {
+            point3_t center = random_point(rng, -10, 10);
+            vec3_t extent{ 0.5, 0.5, 0.5 };
+            boxes.push_back({ center - extent, center + extent });
+        }
+
+        // Mirrors BVH traversal - the reciprocal direction is computed once per ray.
+        uint64_t hits = 0;
+        auto start = bench_clock_t::now();
+        for (int32_t n = 0; n < repeat_count; ++n)
+        {
+            for (auto const& r : rays)
+            {
+                box_ray_t const box_ray{ r };
+                for (auto const& box : boxes)
+                    hits += box.hit(box_ray, elem_t(0.001), elem_t(1e30)) ? 1 : 0;
+            }
+        }
+        auto elapsed = bench_clock_t::now() - start;
+        g_sink = hits;
+        report("ray/box", uint64_t(repeat_count) * rays.size() * boxes.size(), elapsed);
+    }
+
+    void bench_ray_sphere(std::vector<ray_t> const& rays, rng_t& rng)
+    {
+        std::vector<sphere_t> spheres;
+        for (int32_t i = 0; i < primitive_count; ++i)
+            spheres.emplace_back(random_point(rng, -10, 10), elem_t(0.5), nullptr);
+
+        uint64_t hits = 0;
+        sphere_t::hit_result_t result;
+        auto start = bench_clock_t::now();
+        for (int32_t n = 0; n < repeat_count; ++n)
+        {
+            for (auto const& r : rays)
+            {
+                for (auto const& sphere : spheres)
+                    hits += sphere.hit(r, elem_t(0.001), elem_t(1e30), result) ? 1 : 0;
+            }
+        }
+        auto elapsed = bench_clock_t::now() - start;
+        g_sink = hits;
+        report("ray/sphere", uint64_t(repeat_count) * rays.size() * spheres.size(), elapsed);
+    }
+
+    void bench_ray_triangle(std::vector<ray_t> const& rays, rng_t& rng)
+    {
+        // Vertices of each triangle, stored as a mesh stores them
+        std::vector<elem_t> vertices;
+        for (int32_t i = 0; i < primitive_count; ++i)
+        {
+            point3_t const center = random_point(rng, -10, 10);
+            for (int32_t j = 0; j < 3; ++j)
+            {
+                point3_t const p = center + random_point(rng, -1, 1);
+                vertices.insert(vertices.end(), { p.x(), p.y(), p.z() });
+            }
+        }
+
+        // Mirrors mesh traversal - the ray is sheared once per ray.
+        uint64_t hits = 0;
+        elem_t t, u, v, w;
+        auto start = bench_clock_t::now();
+        for (int32_t n = 0; n < repeat_count; ++n)
+        {
+            for (auto const& r : rays)
+            {
+                triangle_ray_t const triangle_ray{ r };
+                for (size_t i = 0; i < vertices.size(); i += 9)
+                {
+                    elem_t const* a = &vertices[i];
+                    hits += triangle_hit(a, a + 3, a + 6, triangle_ray, elem_t(0.001), elem_t(1e30), t, u, v, w) ? 1 : 0;
+                }
+            }
+        }
+        auto elapsed = bench_clock_t::now() - start;
+        g_sink = hits;
+        report("ray/triangle", uint64_t(repeat_count) * rays.size() * primitive_count, elapsed);
+    }
+
+    // Closest-hit query against every sphere of a world - reported per ray/sphere test.
+    void bench_closest_hit(char const* name, hittable_t const& world, std::vector<ray_t> const& rays)
+    {
+        uint64_t hits = 0;
+        hittable_t::hit_result_t result;
+        auto start = bench_clock_t::now();
+        for (auto const& r : rays)
+            hits += world.hit(r, elem_t(0.001), elem_t(1e30), result) ? 1 : 0;
+        auto elapsed = bench_clock_t::now() - start;
+        g_sink = hits;
+        report(name, uint64_t(rays.size()) * scene_sphere_count, elapsed);
+    }
+
+    void bench_list_vs_soa(std::vector<ray_t> const& rays, rng_t& rng)
+    {
+        scene_t scene;
+        sphere_soa_t soa;
+        for (int32_t i = 0; i < scene_sphere_count; ++i)
+        {
+            point3_t center = random_point(rng, -10, 10);
+            scene.add_sphere(center, elem_t(0.2), nullptr);
+            soa.add(center, elem_t(0.2), nullptr);
+        }
+
+        bench_closest_hit("list", scene.world(), rays);
+        bench_closest_hit("sphere soa", soa, rays);
+    }
+
+    // Forwards closest-hit queries to a world and counts them.
+    // Each query is one segment of a path.
+    class counting_hittable_t final : public hittable_t
+    {
+        hittable_t const& _world;
+        mutable uint64_t _queries = 0;
+    public:
+        explicit counting_hittable_t(hittable_t const& world)
+            : _world{ world }
+        { }
+
+        uint64_t queries() const { return _queries; }
+
+        bool hit(ray_t const& r, elem_t t_min, elem_t t_max, hit_result_t& result) const override
+        {
+            ++_queries;
+            return _world.hit(r, t_min, t_max, result);
+        }
+
+        bool bounding_box(aabb_t& output_box) const override
+        {
+            return _world.bounding_box(output_box);
+        }
+    };
+
+    struct convergence_result_t final
+    {
+        double mean; // Mean luminance of all samples
+        double std_error; // Standard error of the mean
+        double path_length; // Segments per path
+        double seconds;
+    };
+
+    // Render the random scene and summarize the samples.
+    convergence_result_t render_convergence(hittable_t const& world, camera_t const& camera, path_settings_t const& settings)
+    {
+        counting_hittable_t counted{ world };
+        double sum = 0;
+        double sq_sum = 0;
+        auto start = bench_clock_t::now();
+        for (int32_t y = 0; y < convergence_height; ++y)
+        {
+            for (int32_t x = 0; x < convergence_width; ++x)
+            {
+                for (int32_t s = 0; s < convergence_samples; ++s)
+                {
+                    rng_t rng{ 0, static_cast<uint64_t>(y) * convergence_width + x, static_cast<uint64_t>(s) };
+                    auto u = (x + random_value<elem_t>(rng)) / (convergence_width - 1);
+                    auto v = (convergence_height - 1 - y + random_value<elem_t>(rng)) / (convergence_height - 1);
+                    ray_t r = camera.get_ray(u, v, rng);
+
+                    hittable_t::hit_result_t hit;
+                    bool const is_hit = counted.hit(r, hit_t_min<elem_t>, std::numeric_limits<elem_t>::infinity(), hit);
+                    double const l = luminance(ray_color(r, is_hit ? &hit : nullptr, counted, rng, settings));
+                    sum += l;
+                    sq_sum += l * l;
+                }
+            }
+        }
+        auto elapsed = bench_clock_t::now() - start;
+
+        double const n = double(convergence_width) * convergence_height * convergence_samples;
+        double const mean = sum / n;
+        double const variance = (sq_sum - n * mean * mean) / (n - 1);
+        return {
+            mean,
+            std::sqrt(variance / n),
+            counted.queries() / n,
+            std::chrono::duration<double>(elapsed).count() };
+    }
+
+    // Russian roulette must leave the mean image unchanged while shortening paths.
+    // Returns false if the means differ by 3 or more standard errors.
+    bool bench_roulette()
+    {
+        scene_t scene;
+        rng_t scene_rng{ 0, std::numeric_limits<uint64_t>::max() };
+        random_scene(scene_rng, scene);
+        bvh_t world{ scene.world() };
+        camera_t camera = random_scene_camera(elem_t(convergence_width) / convergence_height);
+
+        path_settings_t no_roulette;
+        no_roulette.roulette_min_depth = no_roulette.max_bounce;
+        path_settings_t roulette;
+
+        // Warm up caches so the first timed render is not penalized.
+        render_convergence(world, camera, no_roulette);
+
+        convergence_result_t const off = render_convergence(world, camera, no_roulette);
+        convergence_result_t const on = render_convergence(world, camera, roulette);
+
+        for (auto const& [name, result] : { std::pair{ "roulette off", off }, std::pair{ "roulette on", on } })
+        {
+            std::printf("%-12s mean %.5f +/- %.5f  %6.3f segments/path  %6.3f s\n",
+                name,
+                result.mean,
+                result.std_error,
+                result.path_length,
+                result.seconds);
+        }
+
+        // The renders share random streams, which makes this test conservative.
+        double const difference = on.mean - off.mean;
+        double const z = difference / std::sqrt(off.std_error * off.std_error + on.std_error * on.std_error);
+        bool const unchanged = std::abs(z) < 3;
+        std::printf("%-12s mean difference %.2f standard errors (%s)  path length %+.1f%%  time %+.1f%%\n",
+            "roulette",
+            z,
+            unchanged ? "unchanged" : "CHANGED",
+            100 * (on.path_length / off.path_length - 1),
+            100 * (on.seconds / off.seconds - 1));
+        return unchanged;
+    }
+
+    // Size of the images rendered to compare samplers
+    int32_t const sampler_width = 60;
+    int32_t const sampler_height = 40;
+    uint32_t const sampler_samples = 16;
+    uint32_t const sampler_reference_samples = 256;
+
+    // Add the samples of each pixel to 'accumulation', and their first
+    // surfaces to 'features' if given.
+    void render_samples(hittable_t const& world, camera_t const& camera, sampler_t const* sampler, uint64_t seed, uint32_t samples, accumulation_buffer_t& accumulation, feature_buffer_t* features = nullptr)
+    {
+        for (int32_t y = 0; y < sampler_height; ++y)
+        {
+            for (int32_t x = 0; x < sampler_width; ++x)
+            {
+                for (uint32_t s = 0; s < samples; ++s)
+                {
+                    rng_t rng{ sampler, seed, static_cast<uint64_t>(y) * sampler_width + x, s };
+                    auto u = (x + random_value<elem_t>(rng)) / (sampler_width - 1);
+                    auto v = (sampler_height - 1 - y + random_value<elem_t>(rng)) / (sampler_height - 1);
+                    ray_t r = camera.get_ray(u, v, rng);
+
+                    hittable_t::hit_result_t hit;
+                    bool const is_hit = world.hit(r, hit_t_min<elem_t>, std::numeric_limits<elem_t>::infinity(), hit);
+                    surface_features_t surface;
+                    accumulation.pixel(x, y).add(ray_color(r, is_hit ? &hit : nullptr, world, rng, {}, features ? &surface : nullptr));
+                    if (features)
+                        features->pixel(x, y).add(surface);
+                }
+            }
+        }
+    }
+
+    // Gamma-corrected luminance of a linear color
+    double display_luminance(vec3_t const& color)
+    {
+        return std::sqrt(std::max(double(luminance(color)), 0.0));
+    }
+
+    // Mean gamma-corrected luminance of each pixel
+    std::vector<double> render_pixels(hittable_t const& world, camera_t const& camera, sampler_t const* sampler, uint64_t seed, uint32_t samples)
+    {
+        accumulation_buffer_t accumulation{ sampler_width, sampler_height, seed };
+        render_samples(world, camera, sampler, seed, samples, accumulation);
+
+        std::vector<double> pixels;
+        pixels.reserve(sampler_width * sampler_height);
+        for (int32_t y = 0; y < sampler_height; ++y)
+        {
+            for (int32_t x = 0; x < sampler_width; ++x)
+            {
+                auto const& pixel = accumulation.pixel(x, y);
+                pixels.push_back(display_luminance(pixel.color_sum() / static_cast<elem_t>(pixel.samples)));
+            }
+        }
+        return pixels;
+    }
+
+    double rms_error(std::vector<double> const& pixels, std::vector<double> const& reference)
+    {
+        double sq_error = 0;
+        for (size_t i = 0; i < pixels.size(); ++i)
+            sq_error += (pixels[i] - reference[i]) * (pixels[i] - reference[i]);
+        return std::sqrt(sq_error / pixels.size());
+    }
+
+    // Error of each sampler at a low sample count against a converged image.
+    // The reference uses another seed so its noise is independent.
+    void bench_samplers()
+    {
+        scene_t scene;
+        rng_t scene_rng{ 0, std::numeric_limits<uint64_t>::max() };
+        random_scene(scene_rng, scene);
+        bvh_t world{ scene.world() };
+        camera_t camera = random_scene_camera(elem_t(sampler_width) / sampler_height);
+
+        std::vector<double> const reference = render_pixels(world, camera, nullptr, 1, sampler_reference_samples);
+
+        struct sampler_case_t final
+        {
+            char const* name;
+            sampler_kind_t kind;
+            sample_padding_t padding;
+        };
+        sampler_case_t const cases[] = {
+            { "random", sampler_kind_t::random, sample_padding_t::white },
+            { "random+blue", sampler_kind_t::random, sample_padding_t::blue },
+            { "stratified", sampler_kind_t::stratified, sample_padding_t::white },
+            { "halton", sampler_kind_t::halton, sample_padding_t::white },
+            { "sobol", sampler_kind_t::sobol, sample_padding_t::white },
+            { "sobol+blue", sampler_kind_t::sobol, sample_padding_t::blue },
+        };
+
+        for (auto const& c : cases)
+        {
+            std::unique_ptr<sampler_t> sampler = create_sampler(c.kind, c.padding, 0, sampler_width, sampler_samples);
+            auto start = bench_clock_t::now();
+            std::vector<double> const pixels = render_pixels(world, camera, sampler.get(), 0, sampler_samples);
+            auto elapsed = bench_clock_t::now() - start;
+
+            std::printf("%-13s %u spp  RMSE %.5f  %6.3f s\n",
+                c.name,
+                sampler_samples,
+                rms_error(pixels, reference),
+                std::chrono::duration<double>(elapsed).count());
+        }
+
+        // Denoising the sobol image, guided by the first surface of each sample
+        std::unique_ptr<sampler_t> sampler = create_sampler(sampler_kind_t::sobol, sample_padding_t::white, 0, sampler_width, sampler_samples);
+        accumulation_buffer_t accumulation{ sampler_width, sampler_height, 0 };
+        feature_buffer_t features{ sampler_width, sampler_height };
+        auto start = bench_clock_t::now();
+        render_samples(world, camera, sampler.get(), 0, sampler_samples, accumulation, &features);
+        auto const denoise_start = bench_clock_t::now();
+        std::vector<vec3_t> denoised;
+        denoise(accumulation, features, tile_scheduler_t{ sampler_width, sampler_height, 32, 1 }, denoised);
+        auto const end = bench_clock_t::now();
+
+        std::vector<double> pixels;
+        for (vec3_t const& color : denoised)
+            pixels.push_back(display_luminance(color));
+        std::printf("%-13s %u spp  RMSE %.5f  %6.3f s (denoising %.3f s)\n",
+            "sobol+denoise",
+            sampler_samples,
+            rms_error(pixels, reference),
+            std::chrono::duration<double>(end - start).count(),
+            std::chrono::duration<double>(end - denoise_start).count());
+    }
+
+    // Peak resident set size of the process in bytes
+    uint64_t peak_rss()
+    {
+#ifdef BUILD_WINDOWS
+        PROCESS_MEMORY_COUNTERS counters;
+        if (!::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters)))
+            return 0;
+        return counters.PeakWorkingSetSize;
+#else
+        rusage usage;
+        if (::getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+#ifdef BUILD_MACOS
+        return static_cast<uint64_t>(usage.ru_maxrss); // Bytes
+#else
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024; // Kilobytes
+#endif // BUILD_MACOS
+#endif // BUILD_WINDOWS
+    }
+
+    // Scene of the benchmark suite - every scene is rendered at the same size.
+    struct bench_scene_t final
+    {
+        char const* name;
+        sphere_field_t field;
+    };
+
+    int32_t const suite_width = 300;
+    int32_t const suite_height = 200;
+    uint32_t const suite_samples = 8;
+    uint64_t const suite_seed = 0;
+
+    // Render a scene with the wavefront integrator and print its metrics as a JSON object.
+    // Spheres are intersected in F and shaded and accumulated in T - see sphere_bvhT_t.
+    template<typename T, typename F>
+    void bench_scene(bench_scene_t const& bench, char const* precision, int32_t thread_count)
+    {
+        using integrator_t = wavefront_integratorT_t<T>;
+
+        auto const start = bench_clock_t::now();
+
+        sceneT_t<T> scene;
+        rng_t scene_rng{ suite_seed, std::numeric_limits<uint64_t>::max() };
+        sphere_field_scene(scene_rng, scene, bench.field);
+        sphere_bvh_dataT_t<F> sphere_data;
+        auto materials = add_scene_spheres(scene, sphere_data);
+        sphere_data.build();
+        sphere_bvhT_t<T, F> world{ sphere_data, std::move(materials) };
+        cameraT_t<T> camera = random_scene_camera(T(suite_width) / suite_height);
+
+        path_settingsT_t<T> path;
+        path.t_min = hit_t_min<F>;
+
+        auto const render_start = bench_clock_t::now();
+
+        tile_scheduler_t scheduler{ suite_width, suite_height, 32, thread_count };
+        std::vector<integrator_t> integrators(scheduler.thread_count(), integrator_t{ world, path });
+        std::vector<std::vector<vec3T_t<T>>> colors(scheduler.thread_count());
+        scheduler.run([&](tile_t const& tile, int32_t thread_id)
+        {
+            integrator_t& integrator = integrators[thread_id];
+            uint32_t slot = 0;
+            for (int32_t y = tile.y0; y < tile.y1; ++y)
+            {
+                for (int32_t x = tile.x0; x < tile.x1; ++x)
+                {
+                    for (uint32_t s = 0; s < suite_samples; ++s)
+                    {
+                        rng_t rng{ suite_seed, static_cast<uint64_t>(y) * suite_width + x, s };
+                        auto u = (x + random_value<T>(rng)) / (suite_width - 1);
+                        auto v = (suite_height - 1 - y + random_value<T>(rng)) / (suite_height - 1);
+                        integrator.add(camera.get_ray(u, v, rng), rng, slot++);
+                    }
+                }
+            }
+
+            colors[thread_id].resize(slot);
+            integrator.trace(colors[thread_id].data());
+        });
+
+        auto const end = bench_clock_t::now();
+
+        // Stage times are summed over threads.
+        typename integrator_t::stage_stats_t total;
+        for (auto const& integrator : integrators)
+        {
+            auto const& stats = integrator.stats();
+            total.intersections += stats.intersections;
+            total.scatters += stats.scatters;
+            total.intersect_time += stats.intersect_time;
+            total.scatter_time += stats.scatter_time;
+        }
+
+        double const build_seconds = std::chrono::duration<double>(render_start - start).count();
+        double const render_seconds = std::chrono::duration<double>(end - render_start).count();
+        std::printf(
+            "    {\n"
+            "      \"name\": \"%s\",\n"
+            "      \"precision\": \"%s\",\n"
+            "      \"spheres\": %zu,\n"
+            "      \"width\": %d,\n"
+            "      \"height\": %d,\n"
+            "      \"spp\": %u,\n"
+            "      \"rays\": %llu,\n"
+            "      \"scatters\": %llu,\n"
+            "      \"mrays_per_second\": %.3f,\n"
+            "      \"ns_per_intersection\": %.3f,\n"
+            "      \"ns_per_scatter\": %.3f,\n"
+            "      \"build_seconds\": %.4f,\n"
+            "      \"render_seconds\": %.4f,\n"
+            "      \"wall_seconds\": %.4f,\n"
+            "      \"peak_rss_bytes\": %llu\n"
+            "    }",
+            bench.name,
+            precision,
+            scene.spheres().size(),
+            suite_width,
+            suite_height,
+            suite_samples,
+            static_cast<unsigned long long>(total.intersections),
+            static_cast<unsigned long long>(total.scatters),
+            total.intersections / render_seconds * 1e-6,
+            std::chrono::duration<double, std::nano>(total.intersect_time).count() / total.intersections,
+            std::chrono::duration<double, std::nano>(total.scatter_time).count() / total.scatters,
+            build_seconds,
+            render_seconds,
+            build_seconds + render_seconds,
+            static_cast<unsigned long long>(peak_rss()));
+    }
+
+    // Render fixed-seed scenes and print their metrics as JSON.
+    // Scenes run from smallest to largest since peak RSS only grows.
+    void bench_scenes(int32_t thread_count)
+    {
+        sphere_field_t glass_heavy;
+        glass_heavy.diffuse_below = 0.2;
+        glass_heavy.metal_below = 0.3;
+
+        bench_scene_t const scenes[] = {
+            { "random_scene", sphere_field_t{} },
+            { "glass_heavy", glass_heavy },
+            { "spheres_1e4", sphere_field_t{ 100 } },
+            { "spheres_1e5", sphere_field_t{ 316 } },
+        };
+
+        std::printf("{\n"
+            "  \"packet_width\": %d,\n"
+            "  \"threads\": %d,\n"
+            "  \"scenes\": [\n",
+            packet_width,
+            thread_count);
+
+        // Each scene in every precision gen_ppm offers, to show the cost of
+        // double precision and how much of it mixed precision recovers.
+        char const* separator = "";
+        auto run = [&](auto bench)
+        {
+            std::printf("%s", separator);
+            bench();
+            std::fflush(stdout);
+            separator = ",\n";
+        };
+        for (auto const& scene : scenes)
+        {
+            run([&] { bench_scene<float, float>(scene, "float", thread_count); });
+            run([&] { bench_scene<double, double>(scene, "double", thread_count); });
+            run([&] { bench_scene<double, float>(scene, "mixed", thread_count); });
+        }
+        std::printf("\n  ]\n}\n");
+    }
+
+    void print_usage(char const* app)
+    {
+        std::fprintf(stderr,
+            "Usage: %s [--scenes [--threads N]]\n"
+            "  --scenes     Render the benchmark scenes and print their metrics as JSON\n"
+            "  --threads N  Number of render threads for --scenes (default: 1)\n", app);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool scenes = false;
+    int32_t thread_count = 1;
+    for (int i = 1; i < argc; ++i)
+    {
+        char* end = nullptr;
+        if (std::strcmp(argv[i], "--scenes") == 0)
+        {
+            scenes = true;
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            long count = std::strtol(argv[++i], &end, 10);
+            if (*end != '\0' || count < 1)
+            {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            thread_count = static_cast<int32_t>(count);
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (scenes)
+    {
+        bench_scenes(thread_count);
+        return EXIT_SUCCESS;
+    }
+
+    rng_t rng{ 0 };
+    std::vector<ray_t> rays = random_rays(rng);
+
+    bench_vec_ops(rng);
+    bench_ray_box(rays, rng);
+    bench_ray_sphere(rays, rng);
+    bench_ray_triangle(rays, rng);
+    bench_list_vs_soa(rays, rng);
+    bool const roulette_unbiased = bench_roulette();
+    bench_samplers();
+
+    if (!roulette_unbiased)
+    {
+        std::fprintf(stderr, "Russian roulette changed the mean image\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+#ifndef _SRC_INC_AABB_HPP_
+#define _SRC_INC_AABB_HPP_
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include "vec3.hpp"
+#include "ray.hpp"
+
+// Ray prepared for repeated box tests - the reciprocal of the
+// direction is computed once instead of once per box.
+template<typename T>
+struct box_rayT_t final
+{
+    T origin[3];
+    T inv_dir[3];
+
+    box_rayT_t(rayT_t<T> const& r)
+        : origin{ r.origin().x(), r.origin().y(), r.origin().z() }
+        , inv_dir{ 1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z() }
+    { }
+};
+
+// Factor for the far distance of a slab, so rounding cannot make a ray
+// that grazes a box miss it - e.g. a ray through a triangle's vertex at the
+// corner of its box. See Ize, "Robust BVH Ray Traversal" (2013).
+template<typename T>
+inline constexpr T slab_far_scale = 1 + 2 * (T(1.5) * std::numeric_limits<T>::epsilon()) / (1 - T(1.5) * std::numeric_limits<T>::epsilon());
+
+// Branchless slab test of a ray against the box [min, max].
+// The min/max selection lowers to min/max instructions instead of
+// the compare-and-swap of the textbook version.
+template<typename T>
+bool slab_hit(T const (&min)[3], T const (&max)[3], box_rayT_t<T> const& r, T t_min, T t_max)
+{
+    for (int a = 0; a < 3; ++a)
+    {
+        T const t0 = (min[a] - r.origin[a]) * r.inv_dir[a];
+        T const t1 = (max[a] - r.origin[a]) * r.inv_dir[a];
+        t_min = std::max(t_min, std::min(t0, t1));
+        t_max = std::min(t_max, std::max(t0, t1) * slab_far_scale<T>);
+    }
+    return t_min <= t_max;
+}
+
+// Axis-aligned bounding box
+template<typename T>
+class aabbT_t final
+{
+    point3T_t<T> _min;
+    point3T_t<T> _max;
+public:
+    // Default is an empty box - surrounding it with any box yields that box.
+    aabbT_t()
+        : _min{ std::numeric_limits<T>::infinity(), std::numeric_limits<T>::infinity(), std::numeric_limits<T>::infinity() }
+        , _max{ -std::numeric_limits<T>::infinity(), -std::numeric_limits<T>::infinity(), -std::numeric_limits<T>::infinity() }
+    { }
+    aabbT_t(point3T_t<T> const& min, point3T_t<T> const& max)
+        : _min{ min }
+        , _max{ max }
+    { }
+
+    point3T_t<T> min() const { return _min; }
+    point3T_t<T> max() const { return _max; }
+
+    point3T_t<T> centroid() const
+    {
+        return T(0.5) * (_min + _max);
+    }
+
+    T surface_area() const
+    {
+        vec3T_t<T> d = _max - _min;
+        return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    bool hit(box_rayT_t<T> const& r, T t_min, T t_max) const
+    {
+        T const mins[3] = { _min.x(), _min.y(), _min.z() };
+        T const maxs[3] = { _max.x(), _max.y(), _max.z() };
+        return slab_hit(mins, maxs, r, t_min, t_max);
+    }
+
+    bool hit(rayT_t<T> const& r, T t_min, T t_max) const
+    {
+        return hit(box_rayT_t<T>{ r }, t_min, t_max);
+    }
+};
+
+// Returns the smallest box containing both boxes.
+// Bounds are never NaN, so component_min and component_max, which use
+// std::min and std::max, suffice - std::fmin and std::fmax handle NaN at
+// the cost of a library call each.
+template<typename T>
+aabbT_t<T> surrounding_box(aabbT_t<T> const& a, aabbT_t<T> const& b)
+{
+    return { component_min(a.min(), b.min()), component_max(a.max(), b.max()) };
+}
+
+#endif // _SRC_INC_AABB_HPP_
@@ -0,0 +1,273 @@
+#ifndef _SRC_INC_ACCUMULATION_HPP_
+#define _SRC_INC_ACCUMULATION_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "vec3.hpp"
+#include "mapped_file.hpp"
+
+// Relative luminance of a linear color
+template<typename T>
+T luminance(vec3T_t<T> const& color)
+{
+    return T(0.2126) * color.x() + T(0.7152) * color.y() + T(0.0722) * color.z();
+}
+
+// Sum of the samples taken for a pixel.
+// The sum of squared luminances gives the variance of the samples.
+template<typename T>
+struct accumulated_pixelT_t final
+{
+    T sum[3];
+    T luminance_sq_sum;
+    uint32_t samples;
+
+    vec3T_t<T> color_sum() const
+    {
+        return { sum[0], sum[1], sum[2] };
+    }
+
+    void add(vec3T_t<T> const& color)
+    {
+        sum[0] += color.x();
+        sum[1] += color.y();
+        sum[2] += color.z();
+        T const l = luminance(color);
+        luminance_sq_sum += l * l;
+        ++samples;
+    }
+
+    // Estimated standard error of the pixel as displayed.
+    // The error of the mean luminance is scaled by the slope of the
+    // gamma 2 transfer, so dark pixels need less absolute error.
+    T error() const
+    {
+        if (samples < 2)
+            return std::numeric_limits<T>::infinity();
+
+        T const n = static_cast<T>(samples);
+        T const mean = luminance(color_sum()) / n;
+        T const variance = std::max(T(0), (luminance_sq_sum - n * mean * mean) / (n - 1));
+
+        // d/dL sqrt(L) = 1 / (2 sqrt(L)) - the floor avoids blowing up near black.
+        T const display_mean = std::sqrt(std::max(mean, T(0.01)));
+        return std::sqrt(variance / n) / (2 * display_mean);
+    }
+};
+
+// Settings of the estimator the samples of a render are taken with.
+// Samples taken with different settings are not mixed.
+struct accumulation_settings_t final
+{
+    double roulette_max_survival = 0;
+    int32_t max_bounce = 0;
+    int32_t roulette_min_depth = 0;
+    uint32_t precision = 0; // Precision mode, as numbered by the renderer
+    uint32_t reserved = 0;
+
+    bool operator==(accumulation_settings_t const&) const = default;
+};
+
+// Header of an accumulation buffer - also the checkpoint file format.
+// A checkpoint only resumes a render of the same size, seed, sampler and settings.
+struct accumulation_header_t final
+{
+    static constexpr char magic_value[8] = { 'A', 'R', 'T', 'A', 'C', 'C', 0, 0 };
+    static constexpr uint32_t current_version = 4;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t element_size; // Size of each color channel - float or double
+    int32_t width;
+    int32_t height;
+    uint64_t seed;
+    uint64_t sampler; // See sampler_signature()
+    accumulation_settings_t settings;
+};
+
+// Per-pixel color sums and sample counts of a progressive render.
+// Each pass adds samples to the sums so a render can be continued
+// at any time. The buffer lives either in memory or in a checkpoint
+// file mapped into memory, which lets a later run resume the render.
+template<typename T>
+class accumulation_bufferT_t final
+{
+public:
+    using pixel_t = accumulated_pixelT_t<T>;
+
+private:
+    std::unique_ptr<std::byte[]> _memory;
+    mapped_file_t _file;
+    accumulation_header_t* _header;
+    pixel_t* _pixels;
+    int32_t _width;
+    int32_t _height;
+    uint64_t _seed;
+    uint64_t _sampler;
+    accumulation_settings_t _settings;
+public:
+    accumulation_bufferT_t(int32_t width, int32_t height, uint64_t seed, uint64_t sampler = 0, accumulation_settings_t const& settings = {})
+        : _memory{ std::make_unique<std::byte[]>(byte_size(width, height)) }
+        , _width{ width }
+        , _height{ height }
+        , _seed{ seed }
+        , _sampler{ sampler }
+        , _settings{ settings }
+    {
+        attach(_memory.get());
+        init_header();
+    }
+
+    accumulation_bufferT_t(accumulation_bufferT_t const&) = delete;
+    accumulation_bufferT_t& operator=(accumulation_bufferT_t const&) = delete;
+
+    // Move the buffer to a checkpoint file.
+    // An existing checkpoint of the same render replaces the current contents,
+    // otherwise the file is created from them. Returns false if the file
+    // cannot be mapped or belongs to a different render.
+    bool map_checkpoint(char const* path)
+    {
+        size_t const size = byte_size(_width, _height);
+        if (!_file.map(path, size))
+            return false;
+
+        auto* header = static_cast<accumulation_header_t*>(_file.data());
+        if (_file.created())
+        {
+            std::memcpy(_file.data(), _header, size);
+        }
+        else if (std::memcmp(header->magic, accumulation_header_t::magic_value, sizeof(header->magic)) != 0
+            || header->version != accumulation_header_t::current_version
+            || header->element_size != sizeof(T)
+            || header->width != _width
+            || header->height != _height
+            || header->seed != _seed
+            || header->sampler != _sampler
+            || !(header->settings == _settings))
+        {
+            _file.close();
+            return false;
+        }
+
+        attach(_file.data());
+        _memory.reset();
+        return true;
+    }
+
+    // Save the buffer to disk. Does nothing for an in-memory buffer.
+    bool checkpoint()
+    {
+        return _memory || _file.flush();
+    }
+
+    int32_t width() const { return _width; }
+    int32_t height() const { return _height; }
+
+    pixel_t& pixel(int32_t x, int32_t y)
+    {
+        return _pixels[static_cast<size_t>(y) * _width + x];
+    }
+
+    // Fewest samples taken for any pixel
+    uint32_t min_samples() const
+    {
+        size_t const count = static_cast<size_t>(_width) * _height;
+        return std::min_element(_pixels, _pixels + count, [](pixel_t const& a, pixel_t const& b) { return a.samples < b.samples; })->samples;
+    }
+
+    // Most samples taken for any pixel
+    uint32_t max_samples() const
+    {
+        size_t const count = static_cast<size_t>(_width) * _height;
+        return std::max_element(_pixels, _pixels + count, [](pixel_t const& a, pixel_t const& b) { return a.samples < b.samples; })->samples;
+    }
+
+private:
+    static size_t pixels_offset()
+    {
+        return (sizeof(accumulation_header_t) + alignof(pixel_t) - 1) / alignof(pixel_t) * alignof(pixel_t);
+    }
+
+    static size_t byte_size(int32_t width, int32_t height)
+    {
+        return pixels_offset() + sizeof(pixel_t) * width * height;
+    }
+
+    void attach(void* data)
+    {
+        _header = static_cast<accumulation_header_t*>(data);
+        _pixels = reinterpret_cast<pixel_t*>(static_cast<std::byte*>(data) + pixels_offset());
+    }
+
+    void init_header()
+    {
+        std::memcpy(_header->magic, accumulation_header_t::magic_value, sizeof(_header->magic));
+        _header->version = accumulation_header_t::current_version;
+        _header->element_size = sizeof(T);
+        _header->width = _width;
+        _header->height = _height;
+        _header->seed = _seed;
+        _header->sampler = _sampler;
+        _header->settings = _settings;
+    }
+};
+
+// Find the pixels that need no more samples for adaptive sampling.
+// A pixel is converged once it has 'min_samples' and the largest estimated
+// error within 'radius' pixels of it is at most 'threshold'. Few samples
+// can all miss a rare but bright path and understate the error - taking the
+// neighbourhood's error keeps such pixels sampling while their neighbours do.
+template<typename T>
+void find_converged(accumulation_bufferT_t<T>& accumulation, T threshold, uint32_t min_samples, int32_t radius, std::vector<uint8_t>& converged)
+{
+    int32_t const width = accumulation.width();
+    int32_t const height = accumulation.height();
+
+    // The maximum is separable - take it along rows then columns.
+    std::vector<T> errors(static_cast<size_t>(width) * height);
+    std::vector<T> row_max(errors.size());
+    for (int32_t y = 0; y < height; ++y)
+    {
+        for (int32_t x = 0; x < width; ++x)
+        {
+            auto const& pixel = accumulation.pixel(x, y);
+            errors[static_cast<size_t>(y) * width + x] = pixel.samples < min_samples
+                ? std::numeric_limits<T>::infinity()
+                : pixel.error();
+        }
+    }
+
+    for (int32_t y = 0; y < height; ++y)
+    {
+        T const* row = &errors[static_cast<size_t>(y) * width];
+        for (int32_t x = 0; x < width; ++x)
+        {
+            int32_t const x0 = std::max(x - radius, 0);
+            int32_t const x1 = std::min(x + radius + 1, width);
+            row_max[static_cast<size_t>(y) * width + x] = *std::max_element(row + x0, row + x1);
+        }
+    }
+
+    converged.resize(errors.size());
+    for (int32_t y = 0; y < height; ++y)
+    {
+        int32_t const y0 = std::max(y - radius, 0);
+        int32_t const y1 = std::min(y + radius + 1, height);
+        for (int32_t x = 0; x < width; ++x)
+        {
+            T error = 0;
+            for (int32_t n = y0; n < y1; ++n)
+                error = std::max(error, row_max[static_cast<size_t>(n) * width + x]);
+            converged[static_cast<size_t>(y) * width + x] = error <= threshold ? 1 : 0;
+        }
+    }
+}
+
+#endif // _SRC_INC_ACCUMULATION_HPP_
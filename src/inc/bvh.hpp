@@ -0,0 +1,537 @@
+#ifndef _SRC_INC_BVH_HPP_
+#define _SRC_INC_BVH_HPP_
+
+#include <cstdint>
+#include <algorithm>
+#include <bit>
+#include <array>
+#include <limits>
+#include <vector>
+
+#include "aabb.hpp"
+#include "elements.hpp"
+#include "stats.hpp"
+
+// Node of a flattened bounding volume hierarchy.
+// The two children of an interior node are stored next to each other,
+// so only the index of the first is needed.
+template<typename T>
+struct bvh_nodeT_t final
+{
+    T bounds_min[3];
+    int32_t offset; // Leaf - first primitive, Interior - index of left child (right child follows)
+    T bounds_max[3];
+    uint16_t count; // Number of primitives in a leaf, 0 for interior nodes
+    uint8_t axis; // Split axis of an interior node
+    uint8_t pad;
+
+    bool is_leaf() const { return count != 0; }
+
+    aabbT_t<T> bounds() const
+    {
+        return {
+            { bounds_min[0], bounds_min[1], bounds_min[2] },
+            { bounds_max[0], bounds_max[1], bounds_max[2] } };
+    }
+
+    void set_bounds(aabbT_t<T> const& box)
+    {
+        bounds_min[0] = box.min().x();
+        bounds_min[1] = box.min().y();
+        bounds_min[2] = box.min().z();
+        bounds_max[0] = box.max().x();
+        bounds_max[1] = box.max().y();
+        bounds_max[2] = box.max().z();
+    }
+};
+
+static_assert(sizeof(bvh_nodeT_t<float>) == 32, "Single precision nodes should fill half a cache line");
+
+// Builds a flattened BVH over primitive bounds using the binned
+// surface area heuristic (SAH) - see Wald, "On fast Construction of
+// SAH-based Bounding Volume Hierarchies" (2007).
+template<typename T>
+class bvh_builderT_t final
+{
+    static constexpr int32_t bin_count = 16;
+    static constexpr uint32_t max_leaf_size = 4;
+    static constexpr int32_t max_split_depth = 32; // Beyond this, split at the object median
+
+    struct bin_t final
+    {
+        aabbT_t<T> bounds;
+        uint32_t count = 0;
+    };
+
+    // Primitives are partitioned together with their bounds,
+    // so each node reads a contiguous range rather than gathering.
+    struct reference_t final
+    {
+        aabbT_t<T> bounds;
+        point3T_t<T> centroid;
+        uint32_t index;
+    };
+
+    std::vector<reference_t> _refs;
+    std::vector<bvh_nodeT_t<T>>& _nodes;
+    T _traversal_cost;
+
+public:
+    // Bound on the depth of any tree this builder produces.
+    static constexpr int32_t max_depth = 64;
+
+    // Build the hierarchy over the supplied primitive bounds.
+    // On return, 'order' lists primitive indices in leaf order - the
+    // offset and count of a leaf node are a range in 'order'.
+    // 'traversal_cost' is the cost of visiting a node relative to one
+    // primitive test - higher costs give fewer nodes and larger leaves.
+    static void build(
+        std::vector<aabbT_t<T>> const& bounds,
+        std::vector<bvh_nodeT_t<T>>& nodes,
+        std::vector<uint32_t>& order,
+        T traversal_cost = 1)
+    {
+        nodes.clear();
+        order.clear();
+        if (bounds.empty())
+            return;
+
+        bvh_builderT_t builder{ bounds, nodes, traversal_cost };
+        nodes.reserve(2 * bounds.size());
+        nodes.emplace_back();
+        builder.build_node(0, 0, static_cast<uint32_t>(bounds.size()), 0);
+
+        order.reserve(bounds.size());
+        for (reference_t const& ref : builder._refs)
+            order.push_back(ref.index);
+    }
+
+private:
+    bvh_builderT_t(
+        std::vector<aabbT_t<T>> const& bounds,
+        std::vector<bvh_nodeT_t<T>>& nodes,
+        T traversal_cost)
+        : _nodes{ nodes }
+        , _traversal_cost{ traversal_cost }
+    {
+        _refs.reserve(bounds.size());
+        for (uint32_t i = 0; i < bounds.size(); ++i)
+            _refs.push_back({ bounds[i], bounds[i].centroid(), i });
+    }
+
+    void build_node(int32_t node_index, uint32_t begin, uint32_t end, int32_t depth)
+    {
+        aabbT_t<T> node_bounds;
+        aabbT_t<T> centroid_bounds;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            node_bounds = surrounding_box(node_bounds, _refs[i].bounds);
+            point3T_t<T> const& c = _refs[i].centroid;
+            centroid_bounds = surrounding_box(centroid_bounds, aabbT_t<T>{ c, c });
+        }
+        _nodes[node_index].set_bounds(node_bounds);
+
+        uint32_t const count = end - begin;
+        int32_t axis = widest_axis(centroid_bounds);
+        uint32_t mid;
+        if (count <= 1)
+        {
+            mid = end;
+        }
+        else if (depth >= max_split_depth)
+        {
+            // Pathological distribution - fall back to a balanced split so
+            // the tree depth stays within the traversal stack.
+            mid = median_split(axis, begin, end);
+        }
+        else
+        {
+            mid = split(node_bounds, centroid_bounds, begin, end, axis);
+        }
+
+        if (mid == end)
+        {
+            make_leaf(node_index, begin, count);
+            return;
+        }
+
+        // Children are allocated as a pair.
+        int32_t const left = static_cast<int32_t>(_nodes.size());
+        _nodes.emplace_back();
+        _nodes.emplace_back();
+        _nodes[node_index].offset = left;
+        _nodes[node_index].count = 0;
+        _nodes[node_index].axis = static_cast<uint8_t>(axis);
+
+        build_node(left, begin, mid, depth + 1);
+        build_node(left + 1, mid, end, depth + 1);
+    }
+
+    void make_leaf(int32_t node_index, uint32_t begin, uint32_t count)
+    {
+        _nodes[node_index].offset = static_cast<int32_t>(begin);
+        _nodes[node_index].count = static_cast<uint16_t>(count);
+        _nodes[node_index].axis = 0;
+    }
+
+    uint32_t median_split(int32_t axis, uint32_t begin, uint32_t end)
+    {
+        uint32_t const mid = begin + (end - begin) / 2;
+        std::nth_element(_refs.begin() + begin, _refs.begin() + mid, _refs.begin() + end,
+            [&](reference_t const& a, reference_t const& b)
+            {
+                return component(a.centroid, axis) < component(b.centroid, axis);
+            });
+        return mid;
+    }
+
+    // Partition [begin, end) and return the split point and axis.
+    // Returns 'end' if a leaf is cheaper than any split.
+    uint32_t split(aabbT_t<T> const& node_bounds, aabbT_t<T> const& centroid_bounds, uint32_t begin, uint32_t end, int32_t& split_axis)
+    {
+        uint32_t const count = end - begin;
+        T const c_min[3] = { centroid_bounds.min().x(), centroid_bounds.min().y(), centroid_bounds.min().z() };
+        T const c_max[3] = { centroid_bounds.max().x(), centroid_bounds.max().y(), centroid_bounds.max().z() };
+
+        // Bin along all axes in one pass over the primitives - with millions
+        // of primitives the scattered reads of their bounds dominate the build.
+        T scale[3];
+        for (int32_t axis = 0; axis < 3; ++axis)
+        {
+            T const extent = c_max[axis] - c_min[axis];
+            scale[axis] = extent > 0 ? bin_count / extent : 0;
+        }
+
+        std::array<bin_t, bin_count> axis_bins[3];
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            reference_t const& ref = _refs[i];
+            for (int32_t axis = 0; axis < 3; ++axis)
+            {
+                bin_t& bin = axis_bins[axis][bin_index(ref.centroid, axis, c_min[axis], scale[axis])];
+                bin.bounds = surrounding_box(bin.bounds, ref.bounds);
+                bin.count++;
+            }
+        }
+
+        T best_cost = std::numeric_limits<T>::infinity();
+        int32_t best_axis = -1;
+        int32_t best_bin = 0;
+        for (int32_t axis = 0; axis < 3; ++axis)
+        {
+            if (c_max[axis] - c_min[axis] <= 0)
+                continue;
+
+            std::array<bin_t, bin_count> const& bins = axis_bins[axis];
+
+            // Sweep from the right to get the cost of each right-hand side.
+            std::array<T, bin_count> right_cost;
+            aabbT_t<T> right_bounds;
+            uint32_t right_count = 0;
+            for (int32_t b = bin_count - 1; b > 0; --b)
+            {
+                right_bounds = surrounding_box(right_bounds, bins[b].bounds);
+                right_count += bins[b].count;
+                right_cost[b - 1] = right_count == 0 ? 0 : right_count * right_bounds.surface_area();
+            }
+
+            // Sweep from the left and combine.
+            aabbT_t<T> left_bounds;
+            uint32_t left_count = 0;
+            for (int32_t b = 0; b < bin_count - 1; ++b)
+            {
+                left_bounds = surrounding_box(left_bounds, bins[b].bounds);
+                left_count += bins[b].count;
+                if (left_count == 0 || left_count == count)
+                    continue;
+
+                T cost = left_count * left_bounds.surface_area() + right_cost[b];
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+
+        // All centroids coincide - split in the middle if the leaf would be too large.
+        if (best_axis < 0)
+            return count <= max_leaf_size ? end : begin + count / 2;
+
+        T const area = node_bounds.surface_area();
+        T const split_cost = _traversal_cost + best_cost / area;
+        if (split_cost >= count && count <= max_leaf_size)
+            return end;
+
+        split_axis = best_axis;
+        auto mid = std::partition(_refs.begin() + begin, _refs.begin() + end,
+            [&](reference_t const& ref)
+            {
+                return bin_index(ref.centroid, best_axis, c_min[best_axis], scale[best_axis]) <= best_bin;
+            });
+        return static_cast<uint32_t>(mid - _refs.begin());
+    }
+
+    static T component(point3T_t<T> const& p, int32_t axis)
+    {
+        return axis == 0 ? p.x() : axis == 1 ? p.y() : p.z();
+    }
+
+    static int32_t bin_index(point3T_t<T> const& centroid, int32_t axis, T min, T scale)
+    {
+        auto b = static_cast<int32_t>((component(centroid, axis) - min) * scale);
+        return std::clamp(b, 0, bin_count - 1);
+    }
+
+    static int32_t widest_axis(aabbT_t<T> const& box)
+    {
+        vec3T_t<T> d = box.max() - box.min();
+        if (d.x() >= d.y() && d.x() >= d.z())
+            return 0;
+        return d.y() >= d.z() ? 1 : 2;
+    }
+};
+
+// Find the closest hit of a ray in a flattened BVH.
+// 'leaf(offset, count, closest_so_far)' tests the primitives of a leaf,
+// lowering 'closest_so_far' for each hit, and returns true if it found one.
+template<typename T, typename LEAF>
+bool traverse_bvh(bvh_nodeT_t<T> const* nodes, rayT_t<T> const& r, T t_min, T& closest_so_far, LEAF&& leaf)
+{
+    box_rayT_t<T> const box_ray{ r };
+
+    // Direction sign per axis decides which child is nearer.
+    bool const dir_negative[3] = { r.direction().x() < 0, r.direction().y() < 0, r.direction().z() < 0 };
+
+    int32_t stack[bvh_builderT_t<T>::max_depth];
+    int32_t stack_size = 0;
+    int32_t node_index = 0;
+    uint64_t visited = 0;
+    bool hit_anything = false;
+    while (true)
+    {
+        bvh_nodeT_t<T> const& node = nodes[node_index];
+        ++visited;
+        if (slab_hit(node.bounds_min, node.bounds_max, box_ray, t_min, closest_so_far))
+        {
+            if (node.is_leaf())
+            {
+                if (leaf(node.offset, static_cast<int32_t>(node.count), closest_so_far))
+                    hit_anything = true;
+            }
+            else
+            {
+                // Visit the nearer child first, defer the farther one.
+                int32_t const near_child = node.offset + (dir_negative[node.axis] ? 1 : 0);
+                int32_t const far_child = node.offset + (dir_negative[node.axis] ? 0 : 1);
+                stack[stack_size++] = far_child;
+                node_index = near_child;
+                continue;
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+        node_index = stack[--stack_size];
+    }
+
+    count_stat(stat_t::bvh_nodes, visited);
+    return hit_anything;
+}
+
+// Intersect the lanes of a packet set in 'mask' with a flattened BVH.
+// A node is visited if any active lane hits its bounds. Lanes that miss
+// a node are masked off for its subtree. 'leaf(offset, count, mask)'
+// tests the primitives of a leaf, lowering 't_max' of each lane it hits,
+// and returns the mask of lanes it updated.
+template<typename T, typename LEAF>
+uint32_t traverse_bvh_packet(bvh_nodeT_t<T> const* nodes, ray_packetT_t<T> const& r, T t_min, T const* t_max, uint32_t mask, LEAF&& leaf)
+{
+    alignas(32) T inv_dir_x[packet_width];
+    alignas(32) T inv_dir_y[packet_width];
+    alignas(32) T inv_dir_z[packet_width];
+    for (int32_t lane = 0; lane < packet_width; ++lane)
+    {
+        inv_dir_x[lane] = 1 / r.dir_x[lane];
+        inv_dir_y[lane] = 1 / r.dir_y[lane];
+        inv_dir_z[lane] = 1 / r.dir_z[lane];
+    }
+
+    // Coherent rays share direction signs, so the first
+    // active lane decides the near child for the packet.
+    int32_t const lead = std::countr_zero(mask);
+    bool const dir_negative[3] = { r.dir_x[lead] < 0, r.dir_y[lead] < 0, r.dir_z[lead] < 0 };
+
+    struct entry_t final
+    {
+        int32_t node_index;
+        uint32_t mask;
+    };
+    entry_t stack[bvh_builderT_t<T>::max_depth];
+    int32_t stack_size = 0;
+    entry_t current{ 0, mask };
+    uint64_t visited = 0;
+    uint32_t hit_mask = 0;
+    while (true)
+    {
+        bvh_nodeT_t<T> const& node = nodes[current.node_index];
+        ++visited;
+
+        alignas(32) int32_t lane_hit[packet_width];
+        for (int32_t lane = 0; lane < packet_width; ++lane)
+        {
+            T const t0x = (node.bounds_min[0] - r.origin_x[lane]) * inv_dir_x[lane];
+            T const t1x = (node.bounds_max[0] - r.origin_x[lane]) * inv_dir_x[lane];
+            T const t0y = (node.bounds_min[1] - r.origin_y[lane]) * inv_dir_y[lane];
+            T const t1y = (node.bounds_max[1] - r.origin_y[lane]) * inv_dir_y[lane];
+            T const t0z = (node.bounds_min[2] - r.origin_z[lane]) * inv_dir_z[lane];
+            T const t1z = (node.bounds_max[2] - r.origin_z[lane]) * inv_dir_z[lane];
+            T const t_enter = std::max(std::max(t_min, std::min(t0x, t1x)), std::max(std::min(t0y, t1y), std::min(t0z, t1z)));
+            T const t_exit = std::min(t_max[lane], slab_far_scale<T> * std::min(std::max(t0x, t1x), std::min(std::max(t0y, t1y), std::max(t0z, t1z))));
+            lane_hit[lane] = t_enter <= t_exit;
+        }
+
+        uint32_t node_mask = 0;
+        for (int32_t lane = 0; lane < packet_width; ++lane)
+            node_mask |= static_cast<uint32_t>(lane_hit[lane]) << lane;
+        node_mask &= current.mask;
+
+        if (node_mask != 0)
+        {
+            if (node.is_leaf())
+            {
+                hit_mask |= leaf(node.offset, static_cast<int32_t>(node.count), node_mask);
+            }
+            else
+            {
+                // Visit the nearer child first, defer the farther one.
+                int32_t const near_child = node.offset + (dir_negative[node.axis] ? 1 : 0);
+                int32_t const far_child = node.offset + (dir_negative[node.axis] ? 0 : 1);
+                stack[stack_size++] = { far_child, node_mask };
+                current = { near_child, node_mask };
+                continue;
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    count_stat(stat_t::bvh_nodes, visited);
+    return hit_mask;
+}
+
+// Bounding volume hierarchy over a list of hittables
+template<typename T>
+class bvhT_t final : public hittableT_t<T>
+{
+    std::vector<bvh_nodeT_t<T>> _nodes;
+    std::vector<hittableT_t<T> const*> _primitives; // In leaf order
+    std::vector<hittableT_t<T> const*> _unbounded; // Tested against every ray
+public:
+    using hittable_t = hittableT_t<T>;
+    using hit_result_t = typename hittable_t::hit_result_t;
+    using ray_packet_t = typename hittable_t::ray_packet_t;
+    using hit_packet_t = typename hittable_t::hit_packet_t;
+
+    bvhT_t() = default;
+    explicit bvhT_t(hittableT_list_t<T> const& list)
+    {
+        std::vector<aabbT_t<T>> bounds;
+        std::vector<hittable_t const*> bounded;
+        aabbT_t<T> box;
+        for (auto const& hittable : list.objects())
+        {
+            if (hittable->bounding_box(box))
+            {
+                bounds.push_back(box);
+                bounded.push_back(hittable);
+            }
+            else
+            {
+                _unbounded.push_back(hittable);
+            }
+        }
+
+        std::vector<uint32_t> order;
+        bvh_builderT_t<T>::build(bounds, _nodes, order);
+
+        _primitives.reserve(order.size());
+        for (uint32_t i : order)
+            _primitives.push_back(bounded[i]);
+    }
+    virtual ~bvhT_t() = default;
+
+    std::vector<bvh_nodeT_t<T>> const& nodes() const { return _nodes; }
+
+    bool hit(rayT_t<T> const& r, T t_min, T t_max, hit_result_t& result) const override
+    {
+        hit_result_t temp;
+        bool hit_anything = false;
+        auto closest_so_far = t_max;
+        for (auto const& hittable : _unbounded)
+        {
+            if (hittable->hit(r, t_min, closest_so_far, temp))
+            {
+                hit_anything = true;
+                closest_so_far = temp.t;
+                result = temp;
+            }
+        }
+
+        if (_nodes.empty())
+            return hit_anything;
+
+        hit_anything |= traverse_bvh(_nodes.data(), r, t_min, closest_so_far,
+            [&](int32_t offset, int32_t count, T& closest)
+            {
+                bool hit_leaf = false;
+                auto const begin = _primitives.begin() + offset;
+                for (auto iter = begin; iter != begin + count; ++iter)
+                {
+                    if ((*iter)->hit(r, t_min, closest, temp))
+                    {
+                        hit_leaf = true;
+                        closest = temp.t;
+                        result = temp;
+                    }
+                }
+                return hit_leaf;
+            });
+        return hit_anything;
+    }
+
+    uint32_t hit_packet(ray_packet_t const& r, T t_min, hit_packet_t& result, uint32_t mask) const override
+    {
+        uint32_t hit_mask = 0;
+        for (auto const& hittable : _unbounded)
+            hit_mask |= hittable->hit_packet(r, t_min, result, mask);
+
+        if (_nodes.empty() || mask == 0)
+            return hit_mask;
+
+        hit_mask |= traverse_bvh_packet(_nodes.data(), r, t_min, result.t, mask,
+            [&](int32_t offset, int32_t count, uint32_t node_mask)
+            {
+                uint32_t leaf_mask = 0;
+                auto const begin = _primitives.begin() + offset;
+                for (auto iter = begin; iter != begin + count; ++iter)
+                    leaf_mask |= (*iter)->hit_packet(r, t_min, result, node_mask);
+                return leaf_mask;
+            });
+        return hit_mask;
+    }
+
+    bool bounding_box(aabbT_t<T>& box) const override
+    {
+        if (_nodes.empty() || !_unbounded.empty())
+            return false;
+
+        box = _nodes[0].bounds();
+        return true;
+    }
+};
+
+#endif // _SRC_INC_BVH_HPP_
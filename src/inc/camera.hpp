@@ -6,6 +6,8 @@
 #include "vec3.hpp"
 #include "ray.hpp"
 #include "utility.hpp"
+#include "warp.hpp"
+#include "stats.hpp"
 
 template<typename T>
 class cameraT_t final
@@ -47,28 +49,18 @@ public:
         _lens_radius = aperture / 2;
     }
 
-    rayT_t<T> get_ray(T s, T t) const
+    rayT_t<T> get_ray(T s, T t, rng_t& rng) const
     {
-        vec3T_t<T> rd = _lens_radius * random_in_unit_disk();
+        count_stat(stat_t::camera_rays);
+
+        // Random point on the lens for defocus blur (depth of field)
+        vec3T_t<T> rd = _lens_radius * random_in_unit_disk<T>(rng);
         vec3T_t<T> offset = _u * rd.x() + _v * rd.y();
         return {
             _origin + offset,
             _lower_left_corner + s * _horizontal + t * _vertical - _origin - offset
         };
     }
-
-private: // static
-    // Generate random rays for defocus blur effect (depth of field)
-    static vec3T_t<T> random_in_unit_disk()
-    {
-        while (true)
-        {
-            auto p = vec3T_t<T>{ random_value<T>(-1, 1), random_value<T>(-1, 1), 0 };
-            if (p.length_squared() >= 1)
-                continue;
-            return p;
-        }
-    }
 };
 
 #endif // _SRC_INC_CAMERA_HPP_
\ No newline at end of file
@@ -0,0 +1,407 @@
+#ifndef _SRC_INC_DENOISE_HPP_
+#define _SRC_INC_DENOISE_HPP_
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <vector>
+
+#include "vec3.hpp"
+#include "integrator.hpp"
+#include "accumulation.hpp"
+#include "scheduler.hpp"
+
+// Sums of the first surfaces seen by the samples of a pixel
+template<typename T>
+struct accumulated_featuresT_t final
+{
+    T normal[3];
+    T albedo[3];
+    T inverse_distance;
+    uint32_t samples;
+
+    void add(surface_featuresT_t<T> const& features)
+    {
+        normal[0] += features.normal.x();
+        normal[1] += features.normal.y();
+        normal[2] += features.normal.z();
+        albedo[0] += features.albedo.x();
+        albedo[1] += features.albedo.y();
+        albedo[2] += features.albedo.z();
+        inverse_distance += features.inverse_distance;
+        ++samples;
+    }
+};
+
+// Per-pixel first surfaces of the samples of a render.
+// Unlike the accumulation buffer it is not part of a checkpoint, so it
+// only holds the samples taken since the render started. When a run adds
+// samples to a resumed render, the guides cover only the new samples while
+// the colors cover all of them.
+template<typename T>
+class feature_bufferT_t final
+{
+public:
+    using pixel_t = accumulated_featuresT_t<T>;
+
+private:
+    std::vector<pixel_t> _pixels;
+    int32_t _width;
+    int32_t _height;
+public:
+    feature_bufferT_t(int32_t width, int32_t height)
+        : _pixels(static_cast<size_t>(width) * height)
+        , _width{ width }
+        , _height{ height }
+    { }
+
+    int32_t width() const { return _width; }
+    int32_t height() const { return _height; }
+
+    pixel_t& pixel(int32_t x, int32_t y)
+    {
+        return _pixels[static_cast<size_t>(y) * _width + x];
+    }
+
+    pixel_t const& pixel(int32_t x, int32_t y) const
+    {
+        return _pixels[static_cast<size_t>(y) * _width + x];
+    }
+};
+
+// Settings of the denoising filter
+struct denoise_settings_t final
+{
+    // Passes of the filter. Each pass doubles the spacing of its 5x5 taps,
+    // so 5 passes reach 31 pixels away.
+    int32_t passes = 5;
+
+    // Luminance differences are measured in standard deviations of the
+    // noise, so noise is smoothed while edges in the lighting are kept.
+    float luminance_sigma = 2;
+
+    // Neighbours are weighted by exp(-|n_p - n_q|^2 / sigma^2) of their normals.
+    float normal_sigma = 0.5f;
+
+    // Inverse distance differences are measured against the change the
+    // local gradient predicts, so planes seen at grazing angles are still
+    // smoothed while the edges of objects are kept.
+    float depth_sigma = 1;
+};
+
+// exp(-x) for x >= 0 to about 4e-6 relative.
+// Unlike std::exp, loops calling it can be vectorized.
+inline float exp_negative(float x)
+{
+    // 2^y = 2^(i - 1) * 2^f, with i = trunc(y) and f = y - i + 1 in (0, 1]
+    float const y = -1.44269504f * (x < 80.f ? x : 80.f);
+    int32_t const i = static_cast<int32_t>(y);
+    float const f = y - static_cast<float>(i) + 1;
+    float const p = 1.0000036f + f * (0.69296955f + f * (0.24162132f + f * (0.051717735f + f * 0.013683983f)));
+    return std::bit_cast<float>(std::bit_cast<int32_t>(p) + (i - 1) * (1 << 23));
+}
+
+// Edge-avoiding a-trous wavelet filter of a render - see Dammertz et al.,
+// "Edge-Avoiding A-Trous Wavelet Transform for fast Global Illumination
+// Filtering" (2010), and Schied et al., "Spatiotemporal Variance-Guided
+// Filtering" (2017), for the variance-guided weights.
+//
+// Colors are divided by the albedo of their first surface, so the filter
+// smooths lighting without blurring the colors of surfaces, and the albedo
+// is multiplied back at the end. Each pass averages 5x5 taps spaced 2^pass
+// pixels apart. A neighbour's weight falls with its differences in normal,
+// inverse distance and luminance to the pixel, so smoothing stops at the
+// edges of objects and of the lighting. The variance of each pixel is
+// carried through the passes, so luminance edges are judged against the
+// noise that is left.
+//
+// The filter runs in float whatever the precision of the render, over
+// planar buffers so the loop over a row of pixels vectorizes. Tiles are
+// filtered in parallel and 'result' is the denoised image.
+template<typename T>
+void denoise(
+    accumulation_bufferT_t<T>& accumulation,
+    feature_bufferT_t<T> const& features,
+    tile_scheduler_t const& scheduler,
+    std::vector<vec3T_t<T>>& result,
+    denoise_settings_t const& settings = {})
+{
+    int32_t const width = accumulation.width();
+    int32_t const height = accumulation.height();
+    size_t const pixel_count = static_cast<size_t>(width) * height;
+
+    // Dark albedos are clamped so dividing by them does not blow up.
+    float const albedo_floor = 0.01f;
+
+    // Variance of pixels with too few samples to estimate it - large
+    // enough that luminance does not limit smoothing them.
+    float const unknown_variance = 1e6f;
+
+    // Weights of the 5x5 B3 spline kernel by offset
+    float const kernel[3] = { 3.f / 8, 1.f / 4, 1.f / 16 };
+
+    // Planes of the signal being filtered - read from one, written to the other.
+    struct signal_t final
+    {
+        std::vector<float> r;
+        std::vector<float> g;
+        std::vector<float> b;
+        std::vector<float> luminance;
+        std::vector<float> variance;
+    };
+    signal_t signals[2];
+    for (signal_t& signal : signals)
+    {
+        for (auto* plane : { &signal.r, &signal.g, &signal.b, &signal.luminance, &signal.variance })
+            plane->resize(pixel_count);
+    }
+
+    // Guides - the mean first surface of each pixel
+    std::vector<float> nx(pixel_count);
+    std::vector<float> ny(pixel_count);
+    std::vector<float> nz(pixel_count);
+    std::vector<float> depth(pixel_count); // Inverse distance
+    std::vector<float> depth_dx(pixel_count);
+    std::vector<float> depth_dy(pixel_count);
+    std::vector<float> luminance_scale(pixel_count); // 1 / (sigma * standard deviation)
+
+    auto index = [&](int32_t x, int32_t y)
+    {
+        return static_cast<size_t>(y) * width + x;
+    };
+
+    auto mean_albedo = [&](int32_t x, int32_t y)
+    {
+        auto const& pixel = features.pixel(x, y);
+        if (pixel.samples == 0)
+            return vec3T_t<float>{ 1, 1, 1 };
+
+        float const scale = 1.f / pixel.samples;
+        return vec3T_t<float>{
+            std::max(static_cast<float>(pixel.albedo[0]) * scale, albedo_floor),
+            std::max(static_cast<float>(pixel.albedo[1]) * scale, albedo_floor),
+            std::max(static_cast<float>(pixel.albedo[2]) * scale, albedo_floor) };
+    };
+
+    auto mean_depth = [&](int32_t x, int32_t y)
+    {
+        auto const& pixel = features.pixel(x, y);
+        return pixel.samples == 0 ? 0.f : static_cast<float>(pixel.inverse_distance) / pixel.samples;
+    };
+
+    // Of the differences to either side, the smaller is taken as the
+    // gradient, so it is not raised by an edge next to the pixel. At the
+    // border of the image only one side is there.
+    auto gradient = [](float center, float const* before, float const* after)
+    {
+        float const back = before != nullptr ? center - *before : std::numeric_limits<float>::infinity();
+        float const forward = after != nullptr ? *after - center : std::numeric_limits<float>::infinity();
+        float const smaller = std::abs(back) < std::abs(forward) ? back : forward;
+        return std::isinf(smaller) ? 0.f : smaller;
+    };
+
+    // Divide the colors by their albedo and gather the guides.
+    scheduler.run([&](tile_t const& tile, int32_t)
+    {
+        for (int32_t y = tile.y0; y < tile.y1; ++y)
+        {
+            for (int32_t x = tile.x0; x < tile.x1; ++x)
+            {
+                size_t const p = index(x, y);
+                auto const& pixel = accumulation.pixel(x, y);
+                auto const& surface = features.pixel(x, y);
+                vec3T_t<float> const albedo = mean_albedo(x, y);
+
+                float const samples = static_cast<float>(pixel.samples);
+                float const color_scale = pixel.samples == 0 ? 0.f : 1 / samples;
+                vec3T_t<float> const color{
+                    static_cast<float>(pixel.sum[0]) * color_scale / albedo.x(),
+                    static_cast<float>(pixel.sum[1]) * color_scale / albedo.y(),
+                    static_cast<float>(pixel.sum[2]) * color_scale / albedo.z() };
+                signals[0].r[p] = color.x();
+                signals[0].g[p] = color.y();
+                signals[0].b[p] = color.z();
+                signals[0].luminance[p] = luminance(color);
+
+                // Variance of the mean, scaled as the colors are
+                float variance = unknown_variance;
+                if (pixel.samples >= 2)
+                {
+                    float const mean = luminance(pixel.color_sum()) * color_scale;
+                    float const sample_variance = std::max(0.f, (static_cast<float>(pixel.luminance_sq_sum) - samples * mean * mean) / (samples - 1));
+                    float const albedo_luminance = std::max(luminance(albedo), albedo_floor);
+                    variance = sample_variance / samples / (albedo_luminance * albedo_luminance);
+                }
+                signals[0].variance[p] = variance;
+
+                float const normal_scale = surface.samples == 0 ? 0.f : 1.f / surface.samples;
+                nx[p] = static_cast<float>(surface.normal[0]) * normal_scale;
+                ny[p] = static_cast<float>(surface.normal[1]) * normal_scale;
+                nz[p] = static_cast<float>(surface.normal[2]) * normal_scale;
+
+                float const center = mean_depth(x, y);
+                float const left = x > 0 ? mean_depth(x - 1, y) : 0;
+                float const right = x + 1 < width ? mean_depth(x + 1, y) : 0;
+                float const up = y > 0 ? mean_depth(x, y - 1) : 0;
+                float const down = y + 1 < height ? mean_depth(x, y + 1) : 0;
+                depth[p] = center;
+                depth_dx[p] = gradient(center, x > 0 ? &left : nullptr, x + 1 < width ? &right : nullptr);
+                depth_dy[p] = gradient(center, y > 0 ? &up : nullptr, y + 1 < height ? &down : nullptr);
+            }
+        }
+    });
+
+    float const normal_weight = 1 / (settings.normal_sigma * settings.normal_sigma);
+    for (int32_t pass = 0; pass < settings.passes; ++pass)
+    {
+        signal_t const& in = signals[pass % 2];
+        signal_t& out = signals[(pass + 1) % 2];
+        int32_t const step = 1 << pass;
+
+        // Estimates of the variance are noisy - take it over a 3x3
+        // Gaussian before judging luminance differences by it.
+        scheduler.run([&](tile_t const& tile, int32_t)
+        {
+            for (int32_t y = tile.y0; y < tile.y1; ++y)
+            {
+                for (int32_t x = tile.x0; x < tile.x1; ++x)
+                {
+                    float sum = 0;
+                    float weight_sum = 0;
+                    for (int32_t dy = -1; dy <= 1; ++dy)
+                    {
+                        for (int32_t dx = -1; dx <= 1; ++dx)
+                        {
+                            int32_t const qx = x + dx;
+                            int32_t const qy = y + dy;
+                            if (qx < 0 || qx >= width || qy < 0 || qy >= height)
+                                continue;
+
+                            float const weight = float(2 - std::abs(dx)) * float(2 - std::abs(dy));
+                            sum += weight * in.variance[index(qx, qy)];
+                            weight_sum += weight;
+                        }
+                    }
+                    luminance_scale[index(x, y)] = 1 / (settings.luminance_sigma * std::sqrt(sum / weight_sum) + 1e-6f);
+                }
+            }
+        });
+
+        scheduler.run([&](tile_t const& tile, int32_t)
+        {
+            // Plain pointers to the planes, which the compiler can keep in
+            // registers across the stores to the sums.
+            float const* const nx_in = nx.data();
+            float const* const ny_in = ny.data();
+            float const* const nz_in = nz.data();
+            float const* const depth_in = depth.data();
+            float const* const depth_dx_in = depth_dx.data();
+            float const* const depth_dy_in = depth_dy.data();
+            float const* const luminance_scale_in = luminance_scale.data();
+            float const* const r_in = in.r.data();
+            float const* const g_in = in.g.data();
+            float const* const b_in = in.b.data();
+            float const* const luminance_in = in.luminance.data();
+            float const* const variance_in = in.variance.data();
+
+            // Rows are filtered in runs of pixels whose sums over the taps
+            // are local arrays - the compiler can tell they do not overlap
+            // the planes, so the loop over a run vectorizes.
+            constexpr int32_t run_width = 64;
+            float weight_sum[run_width];
+            float r_sum[run_width];
+            float g_sum[run_width];
+            float b_sum[run_width];
+            float variance_sum[run_width];
+
+            for (int32_t y = tile.y0; y < tile.y1; ++y)
+            {
+                for (int32_t run_x0 = tile.x0; run_x0 < tile.x1; run_x0 += run_width)
+                {
+                    int32_t const run_x1 = std::min(run_x0 + run_width, tile.x1);
+                    for (float* sum : { weight_sum, r_sum, g_sum, b_sum, variance_sum })
+                        std::fill_n(sum, run_width, 0.f);
+
+                    for (int32_t ty = -2; ty <= 2; ++ty)
+                    {
+                        int32_t const qy = y + ty * step;
+                        if (qy < 0 || qy >= height)
+                            continue;
+
+                        for (int32_t tx = -2; tx <= 2; ++tx)
+                        {
+                            // Pixels of the run whose tap lies in the image
+                            int32_t const offset = tx * step;
+                            int32_t const x0 = std::max(run_x0, -offset);
+                            int32_t const x1 = std::min(run_x1, width - offset);
+                            float const h = kernel[std::abs(tx)] * kernel[std::abs(ty)];
+                            float const depth_step = settings.depth_sigma * static_cast<float>(step);
+                            float const ax = depth_step * static_cast<float>(std::abs(tx));
+                            float const ay = depth_step * static_cast<float>(std::abs(ty));
+
+                            size_t const row = index(0, y);
+                            size_t const tap_row = index(offset, qy);
+                            for (int32_t x = x0; x < x1; ++x)
+                            {
+                                size_t const p = row + x;
+                                size_t const q = tap_row + x;
+
+                                float const dnx = nx_in[p] - nx_in[q];
+                                float const dny = ny_in[p] - ny_in[q];
+                                float const dnz = nz_in[p] - nz_in[q];
+                                float const expected_depth = ax * std::abs(depth_dx_in[p]) + ay * std::abs(depth_dy_in[p]) + 0.01f * depth_in[p] + 1e-8f;
+                                float const e = std::abs(luminance_in[p] - luminance_in[q]) * luminance_scale_in[p]
+                                    + (dnx * dnx + dny * dny + dnz * dnz) * normal_weight
+                                    + std::abs(depth_in[p] - depth_in[q]) / expected_depth;
+                                float const w = h * exp_negative(e);
+
+                                int32_t const i = x - run_x0;
+                                weight_sum[i] += w;
+                                r_sum[i] += w * r_in[q];
+                                g_sum[i] += w * g_in[q];
+                                b_sum[i] += w * b_in[q];
+                                variance_sum[i] += w * w * variance_in[q];
+                            }
+                        }
+                    }
+
+                    // The center tap always has weight, so the sum is never zero.
+                    for (int32_t x = run_x0; x < run_x1; ++x)
+                    {
+                        size_t const p = index(x, y);
+                        int32_t const i = x - run_x0;
+                        float const scale = 1 / weight_sum[i];
+                        out.r[p] = r_sum[i] * scale;
+                        out.g[p] = g_sum[i] * scale;
+                        out.b[p] = b_sum[i] * scale;
+                        out.luminance[p] = luminance(vec3T_t<float>{ out.r[p], out.g[p], out.b[p] });
+                        out.variance[p] = variance_sum[i] * scale * scale;
+                    }
+                }
+            }
+        });
+    }
+
+    // Multiply the albedo back.
+    signal_t const& filtered = signals[settings.passes % 2];
+    result.resize(pixel_count);
+    scheduler.run([&](tile_t const& tile, int32_t)
+    {
+        for (int32_t y = tile.y0; y < tile.y1; ++y)
+        {
+            for (int32_t x = tile.x0; x < tile.x1; ++x)
+            {
+                size_t const p = index(x, y);
+                vec3T_t<float> const albedo = mean_albedo(x, y);
+                result[p] = {
+                    static_cast<T>(filtered.r[p] * albedo.x()),
+                    static_cast<T>(filtered.g[p] * albedo.y()),
+                    static_cast<T>(filtered.b[p] * albedo.z()) };
+            }
+        }
+    });
+}
+
+#endif // _SRC_INC_DENOISE_HPP_
@@ -1,21 +1,36 @@
 #ifndef _SRC_INC_ELEMENTS_HPP_
 #define _SRC_INC_ELEMENTS_HPP_
 
+#include <cstdint>
 #include <vector>
-#include <memory>
 
 #include "ray.hpp"
+#include "aabb.hpp"
+#include "packet.hpp"
+#include "utility.hpp"
 
 // Forward declaration
 template<typename T>
 class materialT_t;
 
+#ifdef ART_MATERIAL_VARIANT
+template<typename T>
+class material_variantT_t;
+
+// Materials are a closed set stored by value and dispatched without a vtable
+template<typename T>
+using material_handleT_t = material_variantT_t<T> const*;
+#else
+template<typename T>
+using material_handleT_t = materialT_t<T> const*;
+#endif // ART_MATERIAL_VARIANT
+
 template<typename T>
 struct hit_resultT_t
 {
     point3T_t<T> p;
     vec3T_t<T> normal;
-    std::shared_ptr<materialT_t<T>> material; // Reference tracking can be expensive
+    material_handleT_t<T> material; // Non-owning - materials are owned by the scene
     T t;
     bool front_face;
 
@@ -26,6 +41,25 @@ struct hit_resultT_t
     }
 };
 
+// Closest hits found so far for each lane of a ray packet
+template<typename T>
+struct hit_packetT_t
+{
+    T t[packet_width]; // Upper bound of the search interval, shrinks as hits are found
+    hit_resultT_t<T> hits[packet_width]; // Valid for lanes that have been hit
+};
+
+// Closed set of material types - lets integrators group hits by material
+enum class material_kind_t : uint8_t
+{
+    diffuse_simple,
+    diffuse_lambertian,
+    diffuse_hemisphere,
+    metal,
+    dielectric,
+    count
+};
+
 template<typename T>
 struct scatter_resultT_t
 {
@@ -38,7 +72,11 @@ class materialT_t
 {
 public:
     using scatter_result_t = scatter_resultT_t<T>;
-    virtual bool scatter(rayT_t<T> const& ray, hit_resultT_t<T> const& hit, scatter_result_t& result) const = 0;
+    virtual ~materialT_t() = default;
+
+    virtual material_kind_t kind() const = 0;
+
+    virtual bool scatter(rayT_t<T> const& ray, hit_resultT_t<T> const& hit, scatter_result_t& result, rng_t& rng) const = 0;
 };
 
 template<typename T>
@@ -46,21 +84,49 @@ class hittableT_t
 {
 public:
     using hit_result_t = hit_resultT_t<T>;
+    using ray_packet_t = ray_packetT_t<T>;
+    using hit_packet_t = hit_packetT_t<T>;
+    virtual ~hittableT_t() = default;
+
     virtual bool hit(rayT_t<T> const& r, T t_min, T t_max, hit_result_t& result) const = 0;
+
+    // Intersect the lanes of a packet set in 'mask'.
+    // A lane's result is updated only when a hit closer than result.t is found.
+    // Returns the mask of lanes that were updated.
+    virtual uint32_t hit_packet(ray_packet_t const& r, T t_min, hit_packet_t& result, uint32_t mask) const
+    {
+        // Fallback - trace each lane on its own.
+        uint32_t hit_mask = 0;
+        for (int32_t lane = 0; lane < packet_width; ++lane)
+        {
+            if ((mask & (1u << lane)) && hit(r.ray(lane), t_min, result.t[lane], result.hits[lane]))
+            {
+                result.t[lane] = result.hits[lane].t;
+                hit_mask |= 1u << lane;
+            }
+        }
+        return hit_mask;
+    }
+
+    // Returns false if the hittable has no bounds (e.g. an empty list).
+    virtual bool bounding_box(aabbT_t<T>& box) const = 0;
 };
 
+// Non-owning list of hittables - see sceneT_t for ownership
 template<typename T>
 class hittableT_list_t final : public hittableT_t<T>
 {
-    std::vector<std::shared_ptr<hittableT_t<T>>> _hittables;
+    std::vector<hittableT_t<T> const*> _hittables;
 public:
     using hittable_t = hittableT_t<T>;
     using hit_result_t = typename hittable_t::hit_result_t;
+    using ray_packet_t = typename hittable_t::ray_packet_t;
+    using hit_packet_t = typename hittable_t::hit_packet_t;
 
     hittableT_list_t() = default;
     virtual ~hittableT_list_t() = default;
 
-    void add(std::shared_ptr<hittable_t>&& hittable)
+    void add(hittable_t const* hittable)
     {
         _hittables.push_back(hittable);
     }
@@ -70,6 +136,11 @@ public:
         _hittables.clear();
     }
 
+    std::vector<hittable_t const*> const& objects() const
+    {
+        return _hittables;
+    }
+
     bool hit(rayT_t<T> const& r, T t_min, T t_max, hit_result_t& result) const override
     {
         hit_result_t temp;
@@ -86,6 +157,30 @@ public:
         }
         return hit_anything;
     }
+
+    uint32_t hit_packet(ray_packet_t const& r, T t_min, hit_packet_t& result, uint32_t mask) const override
+    {
+        uint32_t hit_mask = 0;
+        for (auto const& hittable : _hittables)
+            hit_mask |= hittable->hit_packet(r, t_min, result, mask);
+        return hit_mask;
+    }
+
+    bool bounding_box(aabbT_t<T>& box) const override
+    {
+        if (_hittables.empty())
+            return false;
+
+        aabbT_t<T> temp;
+        box = {};
+        for (auto const& hittable : _hittables)
+        {
+            if (!hittable->bounding_box(temp))
+                return false;
+            box = surrounding_box(box, temp);
+        }
+        return true;
+    }
 };
 
 #endif // _SRC_INC_ELEMENTS_HPP_
\ No newline at end of file
@@ -0,0 +1,432 @@
+#ifndef _SRC_INC_IMAGE_HPP_
+#define _SRC_INC_IMAGE_HPP_
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "vec3.hpp"
+
+// 8-bit RGB pixel
+struct pixel_t final
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+};
+
+// Convert a linear color to a displayable pixel.
+template<typename T>
+pixel_t to_pixel(vec3T_t<T> color)
+{
+    // Gamma-correct for gamma=2.0 (that is, raise color to power 1/gamma)
+    auto r = std::sqrt(color.x());
+    auto g = std::sqrt(color.y());
+    auto b = std::sqrt(color.z());
+
+    // Write the translated [0,255] value of each color component.
+    auto min = T(0);
+    auto max = T(.999);
+    auto ir = static_cast<uint8_t>(256 * std::clamp(r, min, max));
+    auto ig = static_cast<uint8_t>(256 * std::clamp(g, min, max));
+    auto ib = static_cast<uint8_t>(256 * std::clamp(b, min, max));
+    return { ir, ig, ib };
+}
+
+// Buffered writes to a file.
+// Output is collected in a large buffer and handed to the file in
+// few big writes rather than one call per value. Output not yet
+// flushed when the buffer is destroyed is dropped.
+class output_buffer_t final
+{
+    std::FILE* _file;
+    std::vector<char> _buffer;
+    size_t _size;
+    bool _failed;
+public:
+    explicit output_buffer_t(std::FILE* file, size_t capacity = 1024 * 1024)
+        : _file{ file }
+        , _buffer(capacity)
+        , _size{ 0 }
+        , _failed{ false }
+    { }
+
+    output_buffer_t(output_buffer_t const&) = delete;
+    output_buffer_t& operator=(output_buffer_t const&) = delete;
+
+    // Reserve space for 'size' bytes and return where to write them.
+    // Pending output is flushed if it leaves too little room, and the
+    // buffer grows for writes larger than it.
+    char* reserve(size_t size)
+    {
+        if (_size + size > _buffer.size())
+            flush();
+        if (size > _buffer.size())
+            _buffer.resize(size);
+        return _buffer.data() + _size;
+    }
+
+    // Mark 'size' bytes of reserved space as written.
+    void commit(size_t size)
+    {
+        _size += size;
+    }
+
+    void write(void const* data, size_t size)
+    {
+        std::memcpy(reserve(size), data, size);
+        commit(size);
+    }
+
+    void write(char const* str)
+    {
+        write(str, std::strlen(str));
+    }
+
+    // Drop the output not yet handed to the file.
+    void discard()
+    {
+        _size = 0;
+    }
+
+    // Returns false if any write to the file failed.
+    bool flush()
+    {
+        if (_size != 0 && std::fwrite(_buffer.data(), 1, _size, _file) != _size)
+            _failed = true;
+        _size = 0;
+        if (std::fflush(_file) != 0)
+            _failed = true;
+        return !_failed;
+    }
+};
+
+// On-disk image formats
+enum class image_format_t
+{
+    ppm_ascii, // P3 - https://wikipedia.org/wiki/Netpbm
+    ppm, // P6 - binary PPM
+    pfm, // Portable float map - linear 32-bit float RGB
+};
+
+// Writes an image one row at a time.
+// Rows are passed as linear colors, each writer converts them as needed.
+template<typename T>
+class image_writerT_t
+{
+protected:
+    output_buffer_t _out;
+    int32_t _width = 0;
+    int32_t _height = 0;
+public:
+    explicit image_writerT_t(std::FILE* file)
+        : _out{ file }
+    { }
+
+    virtual ~image_writerT_t() = default;
+
+    // Write the header of an image of the supplied size.
+    virtual void begin(int32_t width, int32_t height)
+    {
+        _width = width;
+        _height = height;
+    }
+
+    // Write the image row 'y', counted from the top.
+    // Rows must be written in the order of row(0), row(1), ...
+    virtual void write_row(int32_t y, vec3T_t<T> const* colors) = 0;
+
+    // The n-th row written to the file, counted from the top.
+    virtual int32_t row(int32_t n) const
+    {
+        return n;
+    }
+
+    // Returns false if the image could not be written.
+    bool end()
+    {
+        return _out.flush();
+    }
+
+    // Drop the output not yet written to the file.
+    void discard()
+    {
+        _out.discard();
+    }
+};
+
+// Plain text PPM - one "r g b" line per pixel
+template<typename T>
+class ppm_ascii_writerT_t final : public image_writerT_t<T>
+{
+    using image_writerT_t<T>::_out;
+    using image_writerT_t<T>::_width;
+public:
+    using image_writerT_t<T>::image_writerT_t;
+
+    void begin(int32_t width, int32_t height) override
+    {
+        image_writerT_t<T>::begin(width, height);
+        char header[64];
+        std::snprintf(header, sizeof(header), "P3\n%d %d\n255\n", width, height);
+        _out.write(header);
+    }
+
+    void write_row(int32_t, vec3T_t<T> const* colors) override
+    {
+        // At most "255 255 255\n" per pixel
+        size_t const max_pixel_size = 12;
+        char* begin = _out.reserve(_width * max_pixel_size);
+        char* iter = begin;
+        for (int32_t i = 0; i < _width; ++i)
+        {
+            pixel_t p = to_pixel(colors[i]);
+            iter = std::to_chars(iter, begin + _width * max_pixel_size, p.r).ptr;
+            *iter++ = ' ';
+            iter = std::to_chars(iter, begin + _width * max_pixel_size, p.g).ptr;
+            *iter++ = ' ';
+            iter = std::to_chars(iter, begin + _width * max_pixel_size, p.b).ptr;
+            *iter++ = '\n';
+        }
+        _out.commit(iter - begin);
+    }
+};
+
+// Binary PPM - three bytes per pixel
+template<typename T>
+class ppm_writerT_t final : public image_writerT_t<T>
+{
+    using image_writerT_t<T>::_out;
+    using image_writerT_t<T>::_width;
+public:
+    using image_writerT_t<T>::image_writerT_t;
+
+    void begin(int32_t width, int32_t height) override
+    {
+        image_writerT_t<T>::begin(width, height);
+        char header[64];
+        std::snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+        _out.write(header);
+    }
+
+    void write_row(int32_t, vec3T_t<T> const* colors) override
+    {
+        static_assert(sizeof(pixel_t) == 3);
+        auto* pixels = reinterpret_cast<pixel_t*>(_out.reserve(_width * sizeof(pixel_t)));
+        for (int32_t i = 0; i < _width; ++i)
+            pixels[i] = to_pixel(colors[i]);
+        _out.commit(_width * sizeof(pixel_t));
+    }
+};
+
+// Portable float map - http://www.pauldebevec.com/Research/HDR/PFM/
+// Colors are written linear, without gamma or clamping.
+// Rows are stored from the bottom of the image up.
+template<typename T>
+class pfm_writerT_t final : public image_writerT_t<T>
+{
+    using image_writerT_t<T>::_out;
+    using image_writerT_t<T>::_width;
+    using image_writerT_t<T>::_height;
+public:
+    using image_writerT_t<T>::image_writerT_t;
+
+    void begin(int32_t width, int32_t height) override
+    {
+        image_writerT_t<T>::begin(width, height);
+
+        // A negative scale marks little-endian data.
+        char header[64];
+        std::snprintf(header, sizeof(header), "PF\n%d %d\n%s\n",
+            width,
+            height,
+            std::endian::native == std::endian::little ? "-1.0" : "1.0");
+        _out.write(header);
+    }
+
+    void write_row(int32_t, vec3T_t<T> const* colors) override
+    {
+        auto* values = reinterpret_cast<float*>(_out.reserve(_width * 3 * sizeof(float)));
+        for (int32_t i = 0; i < _width; ++i)
+        {
+            values[3 * i + 0] = static_cast<float>(colors[i].x());
+            values[3 * i + 1] = static_cast<float>(colors[i].y());
+            values[3 * i + 2] = static_cast<float>(colors[i].z());
+        }
+        _out.commit(_width * 3 * sizeof(float));
+    }
+
+    int32_t row(int32_t n) const override
+    {
+        return _height - 1 - n;
+    }
+};
+
+template<typename T>
+std::unique_ptr<image_writerT_t<T>> create_image_writer(image_format_t format, std::FILE* file)
+{
+    switch (format)
+    {
+    case image_format_t::ppm_ascii:
+        return std::make_unique<ppm_ascii_writerT_t<T>>(file);
+    case image_format_t::pfm:
+        return std::make_unique<pfm_writerT_t<T>>(file);
+    default:
+        return std::make_unique<ppm_writerT_t<T>>(file);
+    }
+}
+
+// Image being rendered and its way to a file.
+// Renderers store linear colors in pixel() and report finished regions with
+// complete(). Without streaming the image is written by finish(). With
+// streaming a writer thread writes each row as soon as it and every row
+// before it in the file are complete, so output overlaps with rendering.
+// The header goes out with the first row. A render that fails calls abort(),
+// or lets the output be destroyed without finish(), and nothing more is
+// written. Streamed rows already handed to the file stay there.
+template<typename T>
+class image_outputT_t final
+{
+    std::unique_ptr<image_writerT_t<T>> _writer;
+    int32_t _width;
+    int32_t _height;
+    std::vector<vec3T_t<T>> _image;
+    bool _begun; // Header written
+    bool _done; // finish() or abort() called
+
+    // Streaming state
+    std::mutex _lock;
+    std::condition_variable _row_ready;
+    std::vector<int32_t> _remaining; // Pixels not yet complete in each row
+    int32_t _next_row; // Number of rows handed to the writer
+    bool _aborted;
+    std::jthread _stream_thread;
+public:
+    image_outputT_t(std::unique_ptr<image_writerT_t<T>> writer, int32_t width, int32_t height, bool streaming)
+        : _writer{ std::move(writer) }
+        , _width{ width }
+        , _height{ height }
+        , _image(static_cast<size_t>(width) * height)
+        , _begun{ false }
+        , _done{ false }
+        , _remaining(height, width)
+        , _next_row{ 0 }
+        , _aborted{ false }
+    {
+        if (streaming)
+            _stream_thread = std::jthread{ [this] { stream_rows(); } };
+    }
+
+    image_outputT_t(image_outputT_t const&) = delete;
+    image_outputT_t& operator=(image_outputT_t const&) = delete;
+
+    ~image_outputT_t()
+    {
+        if (!_done)
+            abort();
+    }
+
+    int32_t width() const { return _width; }
+    int32_t height() const { return _height; }
+
+    vec3T_t<T>& pixel(int32_t x, int32_t y)
+    {
+        return _image[static_cast<size_t>(y) * _width + x];
+    }
+
+    // Report that the pixels [x0, x1) of rows [y0, y1) are final.
+    // Safe to call from any thread.
+    void complete(int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+    {
+        if (!_stream_thread.joinable())
+            return;
+
+        bool ready;
+        {
+            std::scoped_lock lock{ _lock };
+            for (int32_t y = y0; y < y1; ++y)
+                _remaining[y] -= x1 - x0;
+            ready = _next_row < _height && _remaining[_writer->row(_next_row)] == 0;
+        }
+
+        if (ready)
+            _row_ready.notify_one();
+    }
+
+    // Write all rows not yet written and flush the file.
+    // Every pixel must be complete. Returns false if the image could not be written.
+    bool finish()
+    {
+        _done = true;
+        if (_stream_thread.joinable())
+        {
+            {
+                // Release the writer from waiting on rows that were never reported.
+                std::scoped_lock lock{ _lock };
+                std::fill(_remaining.begin(), _remaining.end(), 0);
+            }
+            _row_ready.notify_one();
+            _stream_thread.join();
+        }
+
+        for (; _next_row < _height; ++_next_row)
+            write_row(_writer->row(_next_row));
+        return _writer->end();
+    }
+
+    // Give up on the image. Rows not yet handed to the file are dropped.
+    void abort()
+    {
+        _done = true;
+        if (_stream_thread.joinable())
+        {
+            {
+                std::scoped_lock lock{ _lock };
+                _aborted = true;
+            }
+            _row_ready.notify_one();
+            _stream_thread.join();
+        }
+        _writer->discard();
+    }
+
+private:
+    void write_row(int32_t y)
+    {
+        if (!_begun)
+        {
+            _writer->begin(_width, _height);
+            _begun = true;
+        }
+        _writer->write_row(y, &_image[static_cast<size_t>(y) * _width]);
+    }
+
+    void stream_rows()
+    {
+        std::unique_lock lock{ _lock };
+        while (_next_row < _height)
+        {
+            int32_t const y = _writer->row(_next_row);
+            _row_ready.wait(lock, [&] { return _aborted || _remaining[y] == 0; });
+            if (_aborted)
+                return;
+            ++_next_row;
+
+            // Rendering continues while the row is written.
+            lock.unlock();
+            write_row(y);
+            lock.lock();
+        }
+    }
+};
+
+#endif // _SRC_INC_IMAGE_HPP_
@@ -0,0 +1,246 @@
+#ifndef _SRC_INC_INSTANCE_HPP_
+#define _SRC_INC_INSTANCE_HPP_
+
+#include <cmath>
+#include <algorithm>
+#include <concepts>
+
+#include "vec3.hpp"
+#include "aabb.hpp"
+#include "elements.hpp"
+#include "utility.hpp"
+
+// Affine transform - a 3x4 matrix applied to points as M * (x, y, z, 1).
+// The inverse is kept alongside and built from the inverses of the parts,
+// so no matrix is ever inverted numerically.
+template<typename T>
+    requires std::floating_point<T>
+class transformT_t final
+{
+public:
+    using matrix_t = T[3][4];
+
+private:
+    matrix_t _m;
+    matrix_t _inv;
+public:
+    // Identity
+    transformT_t()
+        : _m{ { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } }
+        , _inv{ { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } }
+    { }
+
+    // Transform from a matrix and its inverse, e.g. as returned by matrix()
+    // and inverse_matrix() of a transform in another precision.
+    template<typename U>
+    static transformT_t from_matrices(U const (&m)[3][4], U const (&inv)[3][4])
+    {
+        transformT_t t;
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int col = 0; col < 4; ++col)
+            {
+                t._m[r][col] = static_cast<T>(m[r][col]);
+                t._inv[r][col] = static_cast<T>(inv[r][col]);
+            }
+        }
+        return t;
+    }
+
+    static transformT_t translate(vec3T_t<T> const& offset)
+    {
+        T const o[3] = { offset.x(), offset.y(), offset.z() };
+        transformT_t t;
+        for (int r = 0; r < 3; ++r)
+        {
+            t._m[r][3] = o[r];
+            t._inv[r][3] = -o[r];
+        }
+        return t;
+    }
+
+    // Scale per axis - factors must not be zero.
+    static transformT_t scale(vec3T_t<T> const& factors)
+    {
+        T const f[3] = { factors.x(), factors.y(), factors.z() };
+        transformT_t t;
+        for (int r = 0; r < 3; ++r)
+        {
+            t._m[r][r] = f[r];
+            t._inv[r][r] = 1 / f[r];
+        }
+        return t;
+    }
+
+    static transformT_t scale(T factor)
+    {
+        return scale({ factor, factor, factor });
+    }
+
+    // Rotation by 'degrees' counter-clockwise around 'axis' (Rodrigues' formula)
+    static transformT_t rotate(vec3T_t<T> const& axis, T degrees)
+    {
+        vec3T_t<T> const a = unit_vector(axis);
+        T const theta = degrees_to_radians(degrees);
+        T const c = std::cos(theta);
+        T const s = std::sin(theta);
+        T const k = 1 - c;
+
+        transformT_t t;
+        T const m[3][3] = {
+            { c + a.x() * a.x() * k, a.x() * a.y() * k - a.z() * s, a.x() * a.z() * k + a.y() * s },
+            { a.y() * a.x() * k + a.z() * s, c + a.y() * a.y() * k, a.y() * a.z() * k - a.x() * s },
+            { a.z() * a.x() * k - a.y() * s, a.z() * a.y() * k + a.x() * s, c + a.z() * a.z() * k } };
+
+        // A rotation's inverse is its transpose.
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int col = 0; col < 3; ++col)
+            {
+                t._m[r][col] = m[r][col];
+                t._inv[r][col] = m[col][r];
+            }
+        }
+        return t;
+    }
+
+    // Transform applying 'rhs' first, then this one.
+    transformT_t operator*(transformT_t const& rhs) const
+    {
+        transformT_t t;
+        multiply(_m, rhs._m, t._m);
+        multiply(rhs._inv, _inv, t._inv);
+        return t;
+    }
+
+    transformT_t inverse() const
+    {
+        transformT_t t;
+        std::copy_n(&_inv[0][0], 12, &t._m[0][0]);
+        std::copy_n(&_m[0][0], 12, &t._inv[0][0]);
+        return t;
+    }
+
+    matrix_t const& matrix() const { return _m; }
+    matrix_t const& inverse_matrix() const { return _inv; }
+
+    bool is_identity() const
+    {
+        transformT_t const identity;
+        return std::equal(&_m[0][0], &_m[0][0] + 12, &identity._m[0][0]);
+    }
+
+    point3T_t<T> point(point3T_t<T> const& p) const { return apply(_m, p, 1); }
+    vec3T_t<T> vector(vec3T_t<T> const& v) const { return apply(_m, v, 0); }
+
+    point3T_t<T> inverse_point(point3T_t<T> const& p) const { return apply(_inv, p, 1); }
+    vec3T_t<T> inverse_vector(vec3T_t<T> const& v) const { return apply(_inv, v, 0); }
+
+    // Normals keep perpendicular to surfaces by the inverse transpose.
+    // The result is not normalized.
+    vec3T_t<T> normal(vec3T_t<T> const& n) const
+    {
+        return {
+            _inv[0][0] * n.x() + _inv[1][0] * n.y() + _inv[2][0] * n.z(),
+            _inv[0][1] * n.x() + _inv[1][1] * n.y() + _inv[2][1] * n.z(),
+            _inv[0][2] * n.x() + _inv[1][2] * n.y() + _inv[2][2] * n.z() };
+    }
+
+    // Box around the transformed corners of 'bounds'
+    aabbT_t<T> box(aabbT_t<T> const& bounds) const
+    {
+        aabbT_t<T> result;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            point3T_t<T> const p{
+                (corner & 1) ? bounds.max().x() : bounds.min().x(),
+                (corner & 2) ? bounds.max().y() : bounds.min().y(),
+                (corner & 4) ? bounds.max().z() : bounds.min().z() };
+            point3T_t<T> const q = point(p);
+            result = surrounding_box(result, { q, q });
+        }
+        return result;
+    }
+
+private: // static
+    static vec3T_t<T> apply(T const (&m)[3][4], vec3T_t<T> const& v, T w)
+    {
+        return {
+            m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z() + m[0][3] * w,
+            m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z() + m[1][3] * w,
+            m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z() + m[2][3] * w };
+    }
+
+    // Product of two affine matrices - the implied last rows are (0, 0, 0, 1).
+    static void multiply(T const (&a)[3][4], T const (&b)[3][4], T (&result)[3][4])
+    {
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int col = 0; col < 4; ++col)
+            {
+                result[r][col] = a[r][0] * b[0][col] + a[r][1] * b[1][col] + a[r][2] * b[2][col];
+                if (col == 3)
+                    result[r][col] += a[r][3];
+            }
+        }
+    }
+};
+
+// Copy of a shared hittable placed by a transform.
+// The child is intersected in its own (object) space: the ray is moved
+// there by the inverse transform and the hit is moved back. The direction
+// is not normalized, so distances along the ray are the same in both
+// spaces. Memory grows with the unique children rather than the copies -
+// an instance is a pointer and two matrices however complex its child.
+// An instance may also replace the materials of its child.
+template<typename T>
+class instanceT_t final : public hittableT_t<T>
+{
+    hittableT_t<T> const* _child; // Non-owning - see sceneT_t
+    transformT_t<T> _transform; // Object to world space
+    material_handleT_t<T> _material; // Null keeps the child's materials
+    aabbT_t<T> _box;
+    bool _bounded;
+public:
+    using hittable_t = hittableT_t<T>;
+    using hit_result_t = typename hittable_t::hit_result_t;
+    using transform_t = transformT_t<T>;
+
+    instanceT_t(hittable_t const* child, transform_t const& transform, material_handleT_t<T> material = nullptr)
+        : _child{ child }
+        , _transform{ transform }
+        , _material{ material }
+    {
+        aabbT_t<T> child_box;
+        _bounded = _child->bounding_box(child_box);
+        if (_bounded)
+            _box = _transform.box(child_box);
+    }
+    virtual ~instanceT_t() = default;
+
+    hittable_t const* child() const { return _child; }
+    transform_t const& transform() const { return _transform; }
+
+    bool hit(rayT_t<T> const& r, T t_min, T t_max, hit_result_t& result) const override
+    {
+        rayT_t<T> const object_ray{ _transform.inverse_point(r.origin()), _transform.inverse_vector(r.direction()) };
+        if (!_child->hit(object_ray, t_min, t_max, result))
+            return false;
+
+        // The child chose the side of the normal facing the ray - the
+        // transform keeps that side, since dot(M d, M^-T n) = dot(d, n).
+        result.p = r.at(result.t);
+        result.normal = unit_vector(_transform.normal(result.normal));
+        if (_material != nullptr)
+            result.material = _material;
+        return true;
+    }
+
+    bool bounding_box(aabbT_t<T>& box) const override
+    {
+        box = _box;
+        return _bounded;
+    }
+};
+
+#endif // _SRC_INC_INSTANCE_HPP_
@@ -0,0 +1,308 @@
+#ifndef _SRC_INC_INTEGRATOR_HPP_
+#define _SRC_INC_INTEGRATOR_HPP_
+
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <limits>
+#include <vector>
+
+#include "vec3.hpp"
+#include "ray.hpp"
+#include "elements.hpp"
+#include "materials.hpp"
+#include "utility.hpp"
+#include "stats.hpp"
+
+// Closest distance along a ray that counts as a hit.
+// Use 0.001 to address "shadow acne". The distance only has to cover the
+// rounding error of a hit point, which is far smaller in double precision.
+template<typename T>
+inline constexpr T hit_t_min = T(0.001);
+
+template<>
+inline constexpr double hit_t_min<double> = 1e-6;
+
+// Color of a ray that escapes the scene
+template<typename T>
+vec3T_t<T> background_color(rayT_t<T> const& r)
+{
+    vec3T_t<T> const gradient_start{ 1, 1, 1 }; // White
+    vec3T_t<T> const gradient_end{ 0.5, 0.7, 1 }; // Light blue
+
+    // The color is gradient along the Y-axis.
+    vec3T_t<T> unit_direction = unit_vector(r.direction());
+    auto t = T(0.5) * (unit_direction.y() + 1);
+    return (1 - t) * gradient_start + t * gradient_end;
+}
+
+// First surface seen by the camera ray of a sample - guides denoising.
+// Camera rays reach the focus plane, so 1/t is proportional to the inverse
+// depth, which changes linearly across a plane in the image.
+template<typename T>
+struct surface_featuresT_t final
+{
+    vec3T_t<T> normal; // Facing the ray - zero if the ray escaped
+    vec3T_t<T> albedo; // Attenuation of the first scatter - the background if the ray escaped
+    T inverse_distance; // 1/t of the hit - zero if the ray escaped
+};
+
+// Limits on the length of a path
+template<typename T>
+struct path_settingsT_t final
+{
+    // Paths are cut off after this many bounces.
+    int32_t max_bounce = 50;
+
+    // Closest distance along a ray that counts as a hit. Must suit the
+    // precision the world is intersected in, which may be lower than T.
+    T t_min = hit_t_min<T>;
+
+    // After this many bounces a path survives with a probability that
+    // follows its throughput - Russian roulette. Survivors are weighted
+    // by the inverse of the probability so the estimate is unbiased.
+    // A depth of at least 'max_bounce' disables Russian roulette.
+    int32_t roulette_min_depth = 3;
+
+    // Upper bound on the survival probability. Below 1 even bright paths
+    // can be terminated, which keeps the path length bounded.
+    T roulette_max_survival = T(0.95);
+};
+
+// Russian roulette - returns false if the path is terminated.
+// Otherwise the throughput is scaled to compensate for terminated paths.
+template<typename T>
+bool survive_roulette(vec3T_t<T>& throughput, int32_t bounce, path_settingsT_t<T> const& settings, rng_t& rng)
+{
+    if (bounce < settings.roulette_min_depth)
+        return true;
+
+    T const survival = std::min(std::max({ throughput.x(), throughput.y(), throughput.z() }), settings.roulette_max_survival);
+    if (random_value<T>(rng) >= survival)
+        return false;
+
+    throughput = throughput / survival;
+    return true;
+}
+
+// Continue a path whose first ray has already been intersected with the world.
+// 'first_hit' is null if the first ray hit nothing. The first surface is
+// written to 'features' if given.
+template<typename T>
+vec3T_t<T> ray_color(rayT_t<T> r, hit_resultT_t<T> const* first_hit, hittableT_t<T> const& world, rng_t& rng, path_settingsT_t<T> const& settings = {}, surface_featuresT_t<T>* features = nullptr)
+{
+    // Accumlation factor for ray bounce.
+    auto acc_factor = vec3T_t<T>{ 1, 1, 1 };
+
+    hit_resultT_t<T> hit;
+    bool is_hit = first_hit != nullptr;
+    if (is_hit)
+        hit = *first_hit;
+    else if (features != nullptr)
+        *features = { {}, background_color(r), 0 };
+    count_stat(stat_t::path_segments);
+
+    // Instead of recursion, iterate.
+    int32_t bounce = 0;
+    while (is_hit)
+    {
+        // Each bounce draws from its own sub-sequence of the sample's stream.
+        rng.set_bounce(bounce + 1);
+
+        // kind() is a virtual call - only make it when counting.
+        if constexpr (stats_enabled)
+            count_scatter(hit.material->kind());
+
+        scatter_resultT_t<T> scatter;
+        bool const scattered = hit.material->scatter(r, hit, scatter, rng);
+        if (bounce == 0 && features != nullptr)
+            *features = { hit.normal, scatter.attenuation, 1 / hit.t };
+
+        if (!scattered)
+        {
+            count_path(stat_t::paths_absorbed, bounce);
+            return {};
+        }
+
+        r = scatter.scattered;
+        acc_factor = acc_factor * scatter.attenuation;
+
+        // If we've exceeded the ray bounce limit, no more light is gathered.
+        if (++bounce == settings.max_bounce)
+        {
+            count_path(stat_t::paths_bounce_limit, bounce);
+            return {};
+        }
+
+        if (!survive_roulette(acc_factor, bounce, settings, rng))
+        {
+            count_path(stat_t::paths_roulette, bounce);
+            return {};
+        }
+
+        // Check if an object was hit.
+        is_hit = world.hit(r, settings.t_min, std::numeric_limits<T>::infinity(), hit);
+        count_stat(stat_t::path_segments);
+    }
+
+    // No objects hit, produce a gradient background.
+    count_path(stat_t::paths_escaped, bounce);
+    return acc_factor * background_color(r);
+}
+
+// Wavefront path tracer.
+// Rather than following one path to completion at a time, a whole batch of
+// paths advances one bounce per iteration in separate stages:
+//  1. Intersect every path in the queue with the world.
+//  2. Bin the hits by material kind. Escaped paths take the background.
+//  3. Run each material's scatter over its bin.
+//  4. Compact the surviving paths into the next queue.
+// Each stage is a tight loop over homogeneous work, which keeps the
+// instruction and data caches warm when there are many samples per pixel.
+//
+// Paths consume their random streams exactly as ray_color() does, so
+// both integrators produce the same colors.
+template<typename T>
+class wavefront_integratorT_t final
+{
+public:
+    // Work done and time spent in the intersect and scatter stages.
+    // Each stage is timed as a whole, which costs a clock read per
+    // stage and bounce rather than per ray.
+    struct stage_stats_t final
+    {
+        uint64_t intersections = 0;
+        uint64_t scatters = 0;
+        std::chrono::steady_clock::duration intersect_time{};
+        std::chrono::steady_clock::duration scatter_time{};
+    };
+
+    struct path_t final
+    {
+        rayT_t<T> ray;
+        vec3T_t<T> throughput;
+        rng_t rng;
+        uint32_t target; // Index of the path's slot in the output
+        int32_t bounce;
+    };
+
+private:
+    static constexpr size_t kind_count = static_cast<size_t>(material_kind_t::count);
+
+    hittableT_t<T> const& _world;
+    path_settingsT_t<T> _settings;
+
+    // Queues are kept between batches to avoid reallocating.
+    std::vector<path_t> _queue;
+    std::vector<path_t> _next_queue;
+    std::vector<hit_resultT_t<T>> _hits;
+    std::array<std::vector<uint32_t>, kind_count> _bins;
+    stage_stats_t _stats;
+public:
+    wavefront_integratorT_t(hittableT_t<T> const& world, path_settingsT_t<T> const& settings = {})
+        : _world{ world }
+        , _settings{ settings }
+    { }
+
+    // Queue a camera path. Its color will be written to the 'target' slot.
+    void add(rayT_t<T> const& r, rng_t const& rng, uint32_t target)
+    {
+        _queue.push_back({ r, { 1, 1, 1 }, rng, target, 0 });
+    }
+
+    stage_stats_t const& stats() const { return _stats; }
+
+    // Trace all queued paths to completion.
+    // The color of each path is written to colors[path.target] - slots of
+    // paths that are absorbed or exceed the bounce limit are set to black.
+    // The first surface of each path is written to features[path.target]
+    // if given, as ray_color() does.
+    void trace(vec3T_t<T>* colors, surface_featuresT_t<T>* features = nullptr)
+    {
+        for (path_t const& path : _queue)
+            colors[path.target] = {};
+
+        while (!_queue.empty())
+        {
+            // Intersect
+            auto const intersect_start = std::chrono::steady_clock::now();
+            _hits.resize(_queue.size());
+            for (auto& bin : _bins)
+                bin.clear();
+
+            for (uint32_t i = 0; i < _queue.size(); ++i)
+            {
+                path_t const& path = _queue[i];
+                if (_world.hit(path.ray, _settings.t_min, std::numeric_limits<T>::infinity(), _hits[i]))
+                {
+                    _bins[static_cast<size_t>(_hits[i].material->kind())].push_back(i);
+                }
+                else
+                {
+                    colors[path.target] = path.throughput * background_color(path.ray);
+                    if (path.bounce == 0 && features != nullptr)
+                        features[path.target] = { {}, background_color(path.ray), 0 };
+                    count_path(stat_t::paths_escaped, path.bounce);
+                }
+            }
+
+            // Scatter each bin, compacting survivors into the next queue
+            auto const scatter_start = std::chrono::steady_clock::now();
+            _stats.intersect_time += scatter_start - intersect_start;
+            _stats.intersections += _queue.size();
+            count_stat(stat_t::path_segments, _queue.size());
+
+            _next_queue.clear();
+            for (size_t kind = 0; kind < kind_count; ++kind)
+            {
+                auto const& bin = _bins[kind];
+                count_scatter(static_cast<material_kind_t>(kind), bin.size());
+
+                for (uint32_t i : bin)
+                {
+                    path_t path = _queue[i];
+                    hit_resultT_t<T> const& hit = _hits[i];
+                    ++_stats.scatters;
+
+                    // Each bounce draws from its own sub-sequence of the sample's stream.
+                    path.rng.set_bounce(path.bounce + 1);
+
+                    scatter_resultT_t<T> scatter;
+                    bool const scattered = hit.material->scatter(path.ray, hit, scatter, path.rng);
+                    if (path.bounce == 0 && features != nullptr)
+                        features[path.target] = { hit.normal, scatter.attenuation, 1 / hit.t };
+
+                    if (!scattered)
+                    {
+                        count_path(stat_t::paths_absorbed, path.bounce);
+                        continue;
+                    }
+
+                    path.ray = scatter.scattered;
+                    path.throughput = path.throughput * scatter.attenuation;
+
+                    // If we've exceeded the ray bounce limit, no more light is gathered.
+                    if (++path.bounce == _settings.max_bounce)
+                    {
+                        count_path(stat_t::paths_bounce_limit, path.bounce);
+                        continue;
+                    }
+
+                    if (!survive_roulette(path.throughput, path.bounce, _settings, path.rng))
+                    {
+                        count_path(stat_t::paths_roulette, path.bounce);
+                        continue;
+                    }
+
+                    _next_queue.push_back(path);
+                }
+            }
+
+            _stats.scatter_time += std::chrono::steady_clock::now() - scatter_start;
+            std::swap(_queue, _next_queue);
+        }
+    }
+};
+
+#endif // _SRC_INC_INTEGRATOR_HPP_
@@ -0,0 +1,198 @@
+#ifndef _SRC_INC_MAPPED_FILE_HPP_
+#define _SRC_INC_MAPPED_FILE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef BUILD_WINDOWS
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // BUILD_WINDOWS
+
+// File mapped into memory.
+// A file mapped for writing receives the writes to the mapping - flush()
+// forces them to disk. A file mapped read-only is paged in on demand.
+class mapped_file_t final
+{
+#ifdef BUILD_WINDOWS
+    HANDLE _file = INVALID_HANDLE_VALUE;
+    HANDLE _mapping = nullptr;
+#else
+    int _file = -1;
+#endif // BUILD_WINDOWS
+    void* _data = nullptr;
+    size_t _size = 0;
+    bool _created = false;
+public:
+    mapped_file_t() = default;
+
+    mapped_file_t(mapped_file_t const&) = delete;
+    mapped_file_t& operator=(mapped_file_t const&) = delete;
+
+    ~mapped_file_t()
+    {
+        close();
+    }
+
+    // Map 'size' bytes of the file at 'path'.
+    // A missing or empty file is created with zeroed contents. Fails if the
+    // file already has a different size, so unrelated files are not clobbered.
+    bool map(char const* path, size_t size)
+    {
+        close();
+        bool const mapped = map_file(path, size);
+        if (!mapped)
+            close();
+        return mapped;
+    }
+
+    // Map the whole of an existing file read-only. Fails if it is empty.
+    bool map_read(char const* path)
+    {
+        close();
+        bool const mapped = map_file_read(path);
+        if (!mapped)
+            close();
+        return mapped;
+    }
+
+    void close()
+    {
+#ifdef BUILD_WINDOWS
+        if (_data != nullptr)
+            ::UnmapViewOfFile(_data);
+        if (_mapping != nullptr)
+            ::CloseHandle(_mapping);
+        if (_file != INVALID_HANDLE_VALUE)
+            ::CloseHandle(_file);
+        _file = INVALID_HANDLE_VALUE;
+        _mapping = nullptr;
+#else
+        if (_data != nullptr)
+            ::munmap(_data, _size);
+        if (_file != -1)
+            ::close(_file);
+        _file = -1;
+#endif // BUILD_WINDOWS
+        _data = nullptr;
+        _size = 0;
+        _created = false;
+    }
+
+    void* data() const { return _data; }
+    size_t size() const { return _size; }
+
+    // True if the file was created (or was empty) when it was mapped.
+    bool created() const { return _created; }
+
+    // Write modified pages to disk.
+    bool flush()
+    {
+        if (_data == nullptr)
+            return false;
+#ifdef BUILD_WINDOWS
+        return ::FlushViewOfFile(_data, _size) && ::FlushFileBuffers(_file);
+#else
+        return ::msync(_data, _size, MS_SYNC) == 0;
+#endif // BUILD_WINDOWS
+    }
+
+private:
+    bool map_file(char const* path, size_t size)
+    {
+#ifdef BUILD_WINDOWS
+        _file = ::CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER file_size;
+        if (!::GetFileSizeEx(_file, &file_size))
+            return false;
+
+        _created = file_size.QuadPart == 0;
+        if (!_created && static_cast<uint64_t>(file_size.QuadPart) != size)
+            return false;
+
+        // The mapping extends the file to its size.
+        LARGE_INTEGER mapping_size;
+        mapping_size.QuadPart = static_cast<LONGLONG>(size);
+        _mapping = ::CreateFileMappingA(_file, nullptr, PAGE_READWRITE, mapping_size.HighPart, mapping_size.LowPart, nullptr);
+        if (_mapping == nullptr)
+            return false;
+
+        _data = ::MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        if (_data == nullptr)
+            return false;
+#else
+        _file = ::open(path, O_RDWR | O_CREAT, 0644);
+        if (_file == -1)
+            return false;
+
+        struct stat file_stat;
+        if (::fstat(_file, &file_stat) != 0)
+            return false;
+
+        _created = file_stat.st_size == 0;
+        if (!_created && static_cast<uint64_t>(file_stat.st_size) != size)
+            return false;
+
+        // Extending the file fills it with zeros.
+        if (_created && ::ftruncate(_file, static_cast<off_t>(size)) != 0)
+            return false;
+
+        void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _file, 0);
+        if (data == MAP_FAILED)
+            return false;
+        _data = data;
+#endif // BUILD_WINDOWS
+        _size = size;
+        return true;
+    }
+
+    bool map_file_read(char const* path)
+    {
+#ifdef BUILD_WINDOWS
+        _file = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER file_size;
+        if (!::GetFileSizeEx(_file, &file_size) || file_size.QuadPart == 0)
+            return false;
+
+        _mapping = ::CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (_mapping == nullptr)
+            return false;
+
+        _data = ::MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (_data == nullptr)
+            return false;
+        _size = static_cast<size_t>(file_size.QuadPart);
+#else
+        _file = ::open(path, O_RDONLY);
+        if (_file == -1)
+            return false;
+
+        struct stat file_stat;
+        if (::fstat(_file, &file_stat) != 0 || file_stat.st_size == 0)
+            return false;
+
+        auto const size = static_cast<size_t>(file_stat.st_size);
+        void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, _file, 0);
+        if (data == MAP_FAILED)
+            return false;
+        _data = data;
+        _size = size;
+#endif // BUILD_WINDOWS
+        return true;
+    }
+};
+
+#endif // _SRC_INC_MAPPED_FILE_HPP_
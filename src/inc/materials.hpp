@@ -3,10 +3,13 @@
 
 #include <algorithm>
 #include <concepts>
+#include <utility>
+#include <variant>
 
 #include "ray.hpp"
 #include "elements.hpp"
 #include "utility.hpp"
+#include "warp.hpp"
 
 // Represents diffuse (matte) material
 template<typename T, typename FORMULA>
@@ -22,9 +25,11 @@ public:
     { }
     virtual ~diffuse_baseT_t() = default;
 
-    bool scatter(rayT_t<T> const& ray, hit_result_t const& hit, scatter_result_t& result) const override
+    material_kind_t kind() const override { return FORMULA::kind; }
+
+    bool scatter(rayT_t<T> const& ray, hit_result_t const& hit, scatter_result_t& result, rng_t& rng) const override
     {
-        point3T_t<T> scatter_direction = FORMULA{}(hit);
+        point3T_t<T> scatter_direction = FORMULA{}(hit, rng);
 
         // Catch degenerate scatter direction
         if (scatter_direction.near_zero())
@@ -45,61 +50,40 @@ class diffuseT final
 public:
     diffuseT() = delete;
 
-private: // static
-    static vec3T_t<T> random_vec3(T min, T max)
-    {
-        return { random_value(min, max), random_value(min, max), random_value(min, max) };
-    }
-
-    static vec3T_t<T> random_in_unit_sphere()
-    {
-        while (true)
-        {
-            auto p = random_vec3(-1, 1);
-            if (p.length_squared() >= 1)
-                continue;
-            return p;
-        }
-    }
-
-    static vec3T_t<T> random_unit_vector()
-    {
-        return unit_vector(random_in_unit_sphere());
-    }
-
-    static vec3T_t<T> random_in_hemisphere(vec3T_t<T> const& normal)
-    {
-        vec3T_t<T> in_unit_sphere = random_in_unit_sphere();
-        return (dot(in_unit_sphere, normal) > 0) // In the same hemisphere as the normal
-            ? in_unit_sphere
-            : -in_unit_sphere;
-    }
-
+private:
     //
     // Diffuse formulation options found in
     // sections 8.1, 8.5 and 8.6
     //
     struct simple_formula final
     {
-        point3T_t<T> operator()(hit_resultT_t<T> const& res) const
+        static constexpr material_kind_t kind = material_kind_t::diffuse_simple;
+
+        point3T_t<T> operator()(hit_resultT_t<T> const& res, rng_t& rng) const
         {
-            return res.normal + random_in_unit_sphere();
+            return res.normal + random_in_unit_sphere<T>(rng);
         }
     };
 
     struct lambertian_formula final
     {
-        point3T_t<T> operator()(hit_resultT_t<T> const& res) const
+        static constexpr material_kind_t kind = material_kind_t::diffuse_lambertian;
+
+        point3T_t<T> operator()(hit_resultT_t<T> const& res, rng_t& rng) const
         {
-            return res.normal + random_unit_vector();
+            // Same distribution of directions as the normal plus a random
+            // unit vector, without the degenerate case of opposite vectors.
+            return random_cosine_direction(res.normal, rng);
         }
     };
 
     struct hemisphere_scattering_formula final
     {
-        point3T_t<T> operator()(hit_resultT_t<T> const& res) const
+        static constexpr material_kind_t kind = material_kind_t::diffuse_hemisphere;
+
+        point3T_t<T> operator()(hit_resultT_t<T> const& res, rng_t& rng) const
         {
-            return random_in_hemisphere(res.normal);
+            return random_in_hemisphere(res.normal, rng);
         }
     };
 
@@ -147,7 +131,9 @@ public:
     { }
     virtual ~metalT_t() = default;
 
-    bool scatter(rayT_t<T> const& ray, hit_result_t const& hit, scatter_result_t& result) const override
+    material_kind_t kind() const override { return material_kind_t::metal; }
+
+    bool scatter(rayT_t<T> const& ray, hit_result_t const& hit, scatter_result_t& result, rng_t& rng) const override
     {
         auto reflected = reflect(unit_vector(ray.direction()), hit.normal);
         result.scattered = { hit.p, reflected };
@@ -170,7 +156,9 @@ public:
     { }
     virtual ~dielectricT_t() = default;
 
-    bool scatter(rayT_t<T> const& ray, hit_result_t const& hit, scatter_result_t& result) const override
+    material_kind_t kind() const override { return material_kind_t::dielectric; }
+
+    bool scatter(rayT_t<T> const& ray, hit_result_t const& hit, scatter_result_t& result, rng_t& rng) const override
     {
         result.attenuation = vec3T_t<T>{ 1, 1, 1 };
         auto refraction_ratio = hit.front_face ? (1 / _ir) : _ir;
@@ -181,7 +169,7 @@ public:
 
         // See section 10.3
         bool cannot_refract = refraction_ratio * sin_theta > 1.0;
-        vec3T_t<T> direction = cannot_refract || reflectance(cos_theta, refraction_ratio) > random_value<T>()
+        vec3T_t<T> direction = cannot_refract || reflectance(cos_theta, refraction_ratio) > random_value<T>(rng)
             ? reflect(unit_direction, hit.normal)
             : refract(unit_direction, hit.normal, refraction_ratio);
 
@@ -199,4 +187,42 @@ private: // static
     }
 };
 
+#ifdef ART_MATERIAL_VARIANT
+// The closed set of materials as a std::variant.
+// The concrete types are final, so visiting the variant calls their
+// scatter() directly and the compiler can inline it - unlike dispatch
+// through materialT_t's vtable.
+template<typename T>
+class material_variantT_t final
+{
+    using diffuse_t = diffuseT<T>;
+    std::variant<
+        typename diffuse_t::simple_t,
+        typename diffuse_t::lambertian_t,
+        typename diffuse_t::hemisphere_scattering_t,
+        metalT_t<T>,
+        dielectricT_t<T>> _material;
+public:
+    using scatter_result_t = scatter_resultT_t<T>;
+
+    template<typename MATERIAL, typename... ARGS>
+    material_variantT_t(std::in_place_type_t<MATERIAL> type, ARGS&&... args)
+        : _material{ type, std::forward<ARGS>(args)... }
+    { }
+
+    material_kind_t kind() const
+    {
+        return std::visit([](auto const& material) { return material.kind(); }, _material);
+    }
+
+    bool scatter(rayT_t<T> const& ray, hit_resultT_t<T> const& hit, scatter_result_t& result, rng_t& rng) const
+    {
+        return std::visit([&](auto const& material)
+            {
+                return material.scatter(ray, hit, result, rng);
+            }, _material);
+    }
+};
+#endif // ART_MATERIAL_VARIANT
+
 #endif // _SRC_INC_MATERIALS_HPP_
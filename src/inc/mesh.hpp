@@ -0,0 +1,525 @@
+#ifndef _SRC_INC_MESH_HPP_
+#define _SRC_INC_MESH_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <charconv>
+#include <concepts>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "vec3.hpp"
+#include "aabb.hpp"
+#include "bvh.hpp"
+#include "elements.hpp"
+#include "mapped_file.hpp"
+#include "stats.hpp"
+
+// Triangles sharing indexed vertex buffers.
+// A vertex used by several triangles is stored once - a triangle is only
+// the indices of its corners.
+template<typename T>
+struct mesh_dataT_t final
+{
+    std::vector<T> positions; // x, y, z of each vertex
+    std::vector<T> normals; // x, y, z of each vertex normal - may be empty
+    std::vector<uint32_t> indices; // Position of each corner - 3 per triangle
+    std::vector<uint32_t> normal_indices; // Normal of each corner - empty without normals
+
+    size_t vertex_count() const { return positions.size() / 3; }
+    size_t normal_count() const { return normals.size() / 3; }
+    size_t triangle_count() const { return indices.size() / 3; }
+
+    point3T_t<T> position(uint32_t vertex) const
+    {
+        return { positions[3 * static_cast<size_t>(vertex) + 0], positions[3 * static_cast<size_t>(vertex) + 1], positions[3 * static_cast<size_t>(vertex) + 2] };
+    }
+
+    vec3T_t<T> normal(uint32_t n) const
+    {
+        return { normals[3 * static_cast<size_t>(n) + 0], normals[3 * static_cast<size_t>(n) + 1], normals[3 * static_cast<size_t>(n) + 2] };
+    }
+
+    // Bytes held by the buffers
+    size_t memory_size() const
+    {
+        return sizeof(T) * (positions.capacity() + normals.capacity())
+            + sizeof(uint32_t) * (indices.capacity() + normal_indices.capacity());
+    }
+};
+
+// Ray prepared for watertight triangle tests - see Woop, Benthin and Wald,
+// "Watertight Ray/Triangle Intersection" (2013). The axis along which the
+// direction is largest becomes z, and vertices are sheared so the ray runs
+// along +z from the origin. A hit is then a 2D point-in-triangle test at the
+// origin, whose edge functions agree along shared edges, so rays cannot
+// slip between neighbouring triangles.
+template<typename T>
+struct triangle_rayT_t final
+{
+    T ox; // Origin, permuted as the axes
+    T oy;
+    T oz;
+    int kx;
+    int ky;
+    int kz;
+    T sx;
+    T sy;
+    T sz;
+
+    triangle_rayT_t(rayT_t<T> const& r)
+    {
+        T const d[3] = { r.direction().x(), r.direction().y(), r.direction().z() };
+        kz = std::abs(d[0]) > std::abs(d[1])
+            ? (std::abs(d[0]) > std::abs(d[2]) ? 0 : 2)
+            : (std::abs(d[1]) > std::abs(d[2]) ? 1 : 2);
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+
+        // Keep the winding of the triangle
+        if (d[kz] < 0)
+            std::swap(kx, ky);
+
+        T const o[3] = { r.origin().x(), r.origin().y(), r.origin().z() };
+        ox = o[kx];
+        oy = o[ky];
+        oz = o[kz];
+        sx = d[kx] / d[kz];
+        sy = d[ky] / d[kz];
+        sz = 1 / d[kz];
+    }
+};
+
+// Watertight ray/triangle test of the triangle (a, b, c) within [t_min, t_max].
+// On a hit, 't' is the distance and 'u', 'v' and 'w' are the barycentric
+// weights of a, b and c.
+template<typename T>
+bool triangle_hit(T const* a, T const* b, T const* c, triangle_rayT_t<T> const& r, T t_min, T t_max, T& t, T& u, T& v, T& w)
+{
+    int const kx = r.kx;
+    int const ky = r.ky;
+    int const kz = r.kz;
+
+    // Vertices relative to the ray origin
+    T const az = a[kz] - r.oz;
+    T const bz = b[kz] - r.oz;
+    T const cz = c[kz] - r.oz;
+    T const ax = (a[kx] - r.ox) - r.sx * az;
+    T const ay = (a[ky] - r.oy) - r.sy * az;
+    T const bx = (b[kx] - r.ox) - r.sx * bz;
+    T const by = (b[ky] - r.oy) - r.sy * bz;
+    T const cx = (c[kx] - r.ox) - r.sx * cz;
+    T const cy = (c[ky] - r.oy) - r.sy * cz;
+
+    // Scaled barycentric coordinates - edge functions of the sheared triangle
+    T e0 = cx * by - cy * bx;
+    T e1 = ax * cy - ay * cx;
+    T e2 = bx * ay - by * ax;
+
+    // On an edge in float - decide in double, as both triangles of
+    // the edge do, so the edge belongs to exactly one of them.
+    if constexpr (std::is_same_v<T, float>)
+    {
+        if (e0 == 0 || e1 == 0 || e2 == 0)
+        {
+            e0 = static_cast<T>(double(cx) * double(by) - double(cy) * double(bx));
+            e1 = static_cast<T>(double(ax) * double(cy) - double(ay) * double(cx));
+            e2 = static_cast<T>(double(bx) * double(ay) - double(by) * double(ax));
+        }
+    }
+
+    // Missed if the signs differ. The signs of a missed triangle are
+    // unpredictable, so they are combined without branches.
+    if (((e0 < 0) | (e1 < 0) | (e2 < 0)) & ((e0 > 0) | (e1 > 0) | (e2 > 0)))
+        return false;
+
+    T const det = e0 + e1 + e2;
+    if (det == 0)
+        return false;
+
+    T const scaled_t = (e0 * az + e1 * bz + e2 * cz) * r.sz;
+    T const inv_det = 1 / det;
+    t = scaled_t * inv_det;
+    if (t < t_min || t_max < t)
+        return false;
+
+    u = e0 * inv_det;
+    v = e1 * inv_det;
+    w = e2 * inv_det;
+    return true;
+}
+
+// Triangle mesh with its own BVH.
+// There is no object per triangle - triangles are index triples into the
+// shared vertex buffers, stored in the leaf order of the BVH so a leaf is
+// a range of triangles. Memory is the vertex buffers plus about 12 bytes
+// per triangle for indices (24 with vertex normals) and 20 for nodes.
+// The mesh takes one material.
+//
+// Triangles facing the ray by their winding - counter-clockwise seen from
+// the front - are front faces. Vertex normals, when given, are interpolated
+// for shading.
+template<typename T>
+class triangle_meshT_t final : public hittableT_t<T>
+{
+    // A node visit costs about as much as a few triangle tests. Leaves of
+    // several triangles halve the nodes, and so their memory, over the
+    // sphere BVHs' cost of 1, without slowing traversal.
+    static constexpr T traversal_cost = 3;
+
+    mesh_dataT_t<T> _data;
+    std::vector<bvh_nodeT_t<T>> _nodes;
+    material_handleT_t<T> _material;
+public:
+    using hittable_t = hittableT_t<T>;
+    using hit_result_t = typename hittable_t::hit_result_t;
+
+    triangle_meshT_t(mesh_dataT_t<T> data, material_handleT_t<T> material)
+        : _data{ std::move(data) }
+        , _material{ material }
+    {
+        build();
+    }
+    virtual ~triangle_meshT_t() = default;
+
+    mesh_dataT_t<T> const& data() const { return _data; }
+    std::vector<bvh_nodeT_t<T>> const& nodes() const { return _nodes; }
+
+    // Bytes held by the mesh and its BVH
+    size_t memory_size() const
+    {
+        return _data.memory_size() + sizeof(bvh_nodeT_t<T>) * _nodes.capacity();
+    }
+
+    bool hit(rayT_t<T> const& r, T t_min, T t_max, hit_result_t& result) const override
+    {
+        if (_nodes.empty())
+            return false;
+
+        triangle_rayT_t<T> const triangle_ray{ r };
+
+        // The hit record is only filled for the closest triangle.
+        T closest_so_far = t_max;
+        int32_t closest_index = -1;
+        T weights[3];
+        traverse_bvh(_nodes.data(), r, t_min, closest_so_far,
+            [&](int32_t offset, int32_t count, T& closest)
+            {
+                count_stat(stat_t::triangle_tests, count);
+
+                bool hit_leaf = false;
+                for (int32_t i = offset; i < offset + count; ++i)
+                {
+                    uint32_t const* corners = &_data.indices[3 * static_cast<size_t>(i)];
+                    T t, u, v, w;
+                    if (triangle_hit(vertex(corners[0]), vertex(corners[1]), vertex(corners[2]), triangle_ray, t_min, closest, t, u, v, w))
+                    {
+                        hit_leaf = true;
+                        closest = t;
+                        closest_index = i;
+                        weights[0] = u;
+                        weights[1] = v;
+                        weights[2] = w;
+                    }
+                }
+                return hit_leaf;
+            });
+
+        if (closest_index < 0)
+            return false;
+
+        set_result(r, closest_index, closest_so_far, weights, result);
+        return true;
+    }
+
+    bool bounding_box(aabbT_t<T>& box) const override
+    {
+        if (_nodes.empty())
+            return false;
+
+        box = _nodes[0].bounds();
+        return true;
+    }
+
+private:
+    T const* vertex(uint32_t index) const
+    {
+        return &_data.positions[3 * static_cast<size_t>(index)];
+    }
+
+    // Build the BVH and store the triangles in its leaf order.
+    void build()
+    {
+        size_t const count = _data.triangle_count();
+        std::vector<aabbT_t<T>> bounds;
+        bounds.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            point3T_t<T> const a = _data.position(_data.indices[3 * i + 0]);
+            point3T_t<T> const b = _data.position(_data.indices[3 * i + 1]);
+            point3T_t<T> const c = _data.position(_data.indices[3 * i + 2]);
+            bounds.push_back({ component_min(component_min(a, b), c), component_max(component_max(a, b), c) });
+        }
+
+        std::vector<uint32_t> order;
+        bvh_builderT_t<T>::build(bounds, _nodes, order, traversal_cost);
+        bounds = {};
+
+        auto const reorder = [&](std::vector<uint32_t>& corners)
+        {
+            if (corners.empty())
+                return;
+            std::vector<uint32_t> ordered(corners.size());
+            for (size_t i = 0; i < order.size(); ++i)
+                std::copy_n(&corners[3 * static_cast<size_t>(order[i])], 3, &ordered[3 * i]);
+            corners.swap(ordered);
+        };
+        reorder(_data.indices);
+        reorder(_data.normal_indices);
+        _nodes.shrink_to_fit();
+    }
+
+    void set_result(rayT_t<T> const& r, int32_t i, T root, T const (&weights)[3], hit_result_t& result) const
+    {
+        uint32_t const* corners = &_data.indices[3 * static_cast<size_t>(i)];
+        point3T_t<T> const a = _data.position(corners[0]);
+        vec3T_t<T> const geometric = unit_vector(cross(_data.position(corners[1]) - a, _data.position(corners[2]) - a));
+
+        result.t = root;
+        result.p = r.at(root);
+        result.material = _material;
+        result.front_face = dot(r.direction(), geometric) < 0;
+
+        vec3T_t<T> normal = geometric;
+        if (!_data.normal_indices.empty())
+        {
+            uint32_t const* normal_corners = &_data.normal_indices[3 * static_cast<size_t>(i)];
+            vec3T_t<T> const shading = weights[0] * _data.normal(normal_corners[0])
+                + weights[1] * _data.normal(normal_corners[1])
+                + weights[2] * _data.normal(normal_corners[2]);
+
+            // Keep the shading normal on the side of the face - degenerate
+            // or flipped vertex normals fall back to the face's.
+            if (dot(shading, geometric) > 0)
+                normal = unit_vector(shading);
+        }
+        result.normal = result.front_face ? normal : -normal;
+    }
+};
+
+// Parser for a subset of the Wavefront OBJ format:
+//
+//   v x y z         Vertex position
+//   vn x y z        Vertex normal
+//   f a b c ...     Face - corners are v, v/vt, v//vn or v/vt/vn
+//
+// Indices start at 1 and negative indices count back from the last
+// vertex or normal read. Faces with more than three corners are split
+// into a fan of triangles. Other statements (vt, o, g, s, usemtl, ...)
+// are skipped. Normals are only kept if every face gives them.
+template<typename T>
+class obj_parserT_t final
+{
+    char const* _pos;
+    char const* _end;
+    int32_t _line;
+    std::string _error;
+public:
+    obj_parserT_t(char const* text, size_t size)
+        : _pos{ text }
+        , _end{ text + size }
+        , _line{ 1 }
+    { }
+
+    std::string const& error() const { return _error; }
+
+    bool parse(mesh_dataT_t<T>& mesh)
+    {
+        mesh = {};
+        bool all_normals = true;
+        std::vector<uint32_t> face;
+        std::vector<uint32_t> face_normals;
+        while (_pos != _end)
+        {
+            std::string_view keyword;
+            next_token(keyword);
+
+            bool parsed = true;
+            if (keyword == "v")
+            {
+                parsed = next_vec3(mesh.positions);
+            }
+            else if (keyword == "vn")
+            {
+                parsed = next_vec3(mesh.normals);
+            }
+            else if (keyword == "f")
+            {
+                parsed = parse_face(mesh, face, face_normals);
+                if (parsed)
+                {
+                    all_normals &= face_normals.size() == face.size();
+
+                    // Fan of triangles around the first corner
+                    for (size_t i = 2; i < face.size(); ++i)
+                    {
+                        mesh.indices.insert(mesh.indices.end(), { face[0], face[i - 1], face[i] });
+                        if (all_normals)
+                            mesh.normal_indices.insert(mesh.normal_indices.end(), { face_normals[0], face_normals[i - 1], face_normals[i] });
+                    }
+                }
+            }
+
+            if (!parsed)
+                return false;
+            skip_line();
+        }
+
+        if (!all_normals)
+        {
+            mesh.normals = {};
+            mesh.normal_indices = {};
+        }
+        if (mesh.indices.size() / 3 > std::numeric_limits<int32_t>::max())
+            return fail("too many triangles");
+        return true;
+    }
+
+private:
+    bool fail(char const* message)
+    {
+        if (_error.empty())
+            _error = "line " + std::to_string(_line) + ": " + message;
+        return false;
+    }
+
+    void skip_blank()
+    {
+        while (_pos != _end && (*_pos == ' ' || *_pos == '\t' || *_pos == '\r'))
+            ++_pos;
+    }
+
+    // Skip the rest of the line, including comments and unused values.
+    void skip_line()
+    {
+        while (_pos != _end && *_pos != '\n')
+            ++_pos;
+        if (_pos != _end)
+        {
+            ++_pos;
+            ++_line;
+        }
+    }
+
+    bool at_end_of_line()
+    {
+        skip_blank();
+        return _pos == _end || *_pos == '\n' || *_pos == '#';
+    }
+
+    bool next_token(std::string_view& token)
+    {
+        skip_blank();
+        char const* begin = _pos;
+        while (_pos != _end && *_pos != ' ' && *_pos != '\t' && *_pos != '\r' && *_pos != '\n' && *_pos != '#')
+            ++_pos;
+        token = { begin, static_cast<size_t>(_pos - begin) };
+        return !token.empty();
+    }
+
+    bool next_vec3(std::vector<T>& values)
+    {
+        for (int32_t i = 0; i < 3; ++i)
+        {
+            skip_blank();
+            T value;
+            auto [end, ec] = std::from_chars(_pos, _end, value);
+            if (ec != std::errc{})
+                return fail("expected a number");
+            // from_chars accepts nan and inf, which would poison the mesh bounds.
+            if (!std::isfinite(value))
+                return fail("invalid number");
+            _pos = end;
+            values.push_back(value);
+        }
+        return true;
+    }
+
+    // Read a 1-based, possibly negative, index into 'count' elements.
+    bool next_index(size_t count, uint32_t& index)
+    {
+        int64_t value;
+        auto [end, ec] = std::from_chars(_pos, _end, value);
+        if (ec != std::errc{})
+            return fail("expected an index");
+        _pos = end;
+
+        int64_t const resolved = value < 0 ? static_cast<int64_t>(count) + value : value - 1;
+        if (value == 0 || resolved < 0 || resolved >= static_cast<int64_t>(count))
+            return fail("index out of range");
+        index = static_cast<uint32_t>(resolved);
+        return true;
+    }
+
+    bool parse_face(mesh_dataT_t<T> const& mesh, std::vector<uint32_t>& face, std::vector<uint32_t>& face_normals)
+    {
+        face.clear();
+        face_normals.clear();
+        while (!at_end_of_line())
+        {
+            uint32_t index = 0;
+            if (!next_index(mesh.vertex_count(), index))
+                return false;
+            face.push_back(index);
+
+            // Texture coordinates are skipped.
+            if (_pos != _end && *_pos == '/')
+            {
+                ++_pos;
+                while (_pos != _end && *_pos != '/' && *_pos != ' ' && *_pos != '\t' && *_pos != '\r' && *_pos != '\n')
+                    ++_pos;
+                if (_pos != _end && *_pos == '/')
+                {
+                    ++_pos;
+                    if (!next_index(mesh.normal_count(), index))
+                        return false;
+                    face_normals.push_back(index);
+                }
+            }
+        }
+
+        if (face.size() < 3)
+            return fail("face with fewer than 3 corners");
+        return true;
+    }
+};
+
+// Load a mesh from an OBJ file - see obj_parserT_t.
+// On failure 'error' describes the problem.
+template<typename T>
+bool load_obj(char const* path, mesh_dataT_t<T>& mesh, std::string& error)
+{
+    mapped_file_t file;
+    if (!file.map_read(path))
+    {
+        error = std::string{ "cannot read " } + path;
+        return false;
+    }
+
+    obj_parserT_t<T> parser{ static_cast<char const*>(file.data()), file.size() };
+    if (!parser.parse(mesh))
+    {
+        error = std::string{ path } + ", " + parser.error();
+        return false;
+    }
+    return true;
+}
+
+#endif // _SRC_INC_MESH_HPP_
@@ -0,0 +1,51 @@
+#ifndef _SRC_INC_PACKET_HPP_
+#define _SRC_INC_PACKET_HPP_
+
+#include <cstdint>
+
+#include "vec3.hpp"
+#include "ray.hpp"
+
+// Number of rays traced together in a packet.
+// Matches the number of float lanes in the widest vector unit enabled.
+#if defined(__AVX2__) || defined(__AVX__)
+inline constexpr int32_t packet_width = 8;
+#else
+inline constexpr int32_t packet_width = 4;
+#endif
+
+// Lane mask with all lanes of a packet set
+inline constexpr uint32_t packet_full_mask = (1u << packet_width) - 1;
+
+// Packet of rays stored as a structure of arrays.
+// Kernels loop over lanes with the same operations for every lane,
+// which the compiler maps to vector instructions.
+template<typename T>
+struct ray_packetT_t final
+{
+    alignas(32) T origin_x[packet_width];
+    alignas(32) T origin_y[packet_width];
+    alignas(32) T origin_z[packet_width];
+    alignas(32) T dir_x[packet_width];
+    alignas(32) T dir_y[packet_width];
+    alignas(32) T dir_z[packet_width];
+
+    void set(int32_t lane, rayT_t<T> const& r)
+    {
+        origin_x[lane] = r.origin().x();
+        origin_y[lane] = r.origin().y();
+        origin_z[lane] = r.origin().z();
+        dir_x[lane] = r.direction().x();
+        dir_y[lane] = r.direction().y();
+        dir_z[lane] = r.direction().z();
+    }
+
+    rayT_t<T> ray(int32_t lane) const
+    {
+        return {
+            { origin_x[lane], origin_y[lane], origin_z[lane] },
+            { dir_x[lane], dir_y[lane], dir_z[lane] } };
+    }
+};
+
+#endif // _SRC_INC_PACKET_HPP_
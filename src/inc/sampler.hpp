@@ -0,0 +1,528 @@
+#ifndef _SRC_INC_SAMPLER_HPP_
+#define _SRC_INC_SAMPLER_HPP_
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "utility.hpp"
+
+// Samplers for the leading draws of each sample.
+// Every sample of a pixel has its own random stream (rng_t). A sampler
+// supplies the first draws of the stream's first bounces from a sequence
+// over the pixel's samples, so the pixel jitter, lens position and first
+// bounce directions of a pixel cover their domains evenly. Fewer samples
+// then reach the same noise level.
+//
+// Draws are numbered per bounce - bounce 0 is the camera - and paired into
+// 2D dimensions: draws 0 and 1 of the camera are the pixel jitter, draws 2
+// and 3 the lens position. Each later bounce starts with its scatter.
+
+enum class sampler_kind_t
+{
+    random, // Independent random values
+    stratified, // Correlated multi-jittered - see Kensler, "Correlated Multi-Jittered Sampling" (2013)
+    halton, // Halton sequence with Owen scrambling
+    sobol, // Sobol (0,2)-sequence per pair of dimensions with Owen scrambling
+};
+
+// Values for draws the sequence does not cover
+enum class sample_padding_t
+{
+    white, // Random values from the sample's stream
+    blue, // Blue noise over the image, rotated for each sample
+};
+
+// Draws of each bounce taken from a sampler
+inline constexpr uint32_t sampled_draws = 4;
+
+// Bounces whose draws come from the sequence. The draws of later bounces are padded.
+inline constexpr uint32_t sequence_bounces = 8;
+
+namespace sampling
+{
+    // Finalizer of MurmurHash3 - every input bit affects every output bit.
+    inline uint64_t mix_bits(uint64_t v)
+    {
+        v ^= v >> 31;
+        v *= 0x7fb5d329728ea185;
+        v ^= v >> 27;
+        v *= 0x81dadef4bc2dd44d;
+        v ^= v >> 33;
+        return v;
+    }
+
+    inline uint32_t reverse_bits(uint32_t v)
+    {
+        v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+        v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+        v = ((v >> 4) & 0x0f0f0f0f) | ((v & 0x0f0f0f0f) << 4);
+        v = ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8);
+        return (v >> 16) | (v << 16);
+    }
+
+    // Hash in which each bit only depends on the bits below it - see
+    // Burley, "Practical Hash-based Owen Scrambling" (2020).
+    inline uint32_t laine_karras_permutation(uint32_t v, uint32_t seed)
+    {
+        v += seed;
+        v ^= v * 0x6c50b47c;
+        v ^= v * 0xb82f1e52;
+        v ^= v * 0xc7afe638;
+        v ^= v * 0x8d22f6e6;
+        return v;
+    }
+
+    // Owen scrambling of a base 2 fraction - each bit is flipped
+    // depending on the bits above it.
+    inline uint32_t owen_scramble(uint32_t v, uint32_t seed)
+    {
+        return reverse_bits(laine_karras_permutation(reverse_bits(v), seed));
+    }
+
+    // Second dimension of the Sobol sequence. The first is the bit reversed index.
+    inline uint32_t sobol_second_dimension(uint32_t index)
+    {
+        uint32_t result = 0;
+        for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+        {
+            if (index & 1)
+                result ^= v;
+        }
+        return result;
+    }
+
+    // Element 'i' of a random permutation of [0, l) chosen by 'p' - see Kensler (2013).
+    inline uint32_t permute(uint32_t i, uint32_t l, uint32_t p)
+    {
+        uint32_t w = l - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do
+        {
+            i ^= p;
+            i *= 0xe170893d;
+            i ^= p >> 16;
+            i ^= (i & w) >> 4;
+            i ^= p >> 8;
+            i *= 0x0929eb3f;
+            i ^= p >> 23;
+            i ^= (i & w) >> 1;
+            i *= 1 | p >> 27;
+            i *= 0x6935fa69;
+            i ^= (i & w) >> 11;
+            i *= 0x74dcb303;
+            i ^= (i & w) >> 2;
+            i *= 0x9e501cc3;
+            i ^= (i & w) >> 2;
+            i *= 0xc860a3df;
+            i &= w;
+            i ^= i >> 5;
+        } while (i >= l);
+        return (i + p) % l;
+    }
+
+    // Random 32-bit fraction for 'i' chosen by 'p' - see Kensler (2013).
+    inline uint32_t random_fraction(uint32_t i, uint32_t p)
+    {
+        i ^= p;
+        i ^= i >> 17;
+        i ^= i >> 10;
+        i *= 0xb36534e5;
+        i ^= i >> 12;
+        i ^= i >> 21;
+        i *= 0x93fc4795;
+        i ^= 0xdf6e307f;
+        i ^= i >> 17;
+        i *= 1 | p >> 18;
+        return i;
+    }
+
+    // Fraction in [0, 1) as 32 bits
+    inline uint32_t to_fraction(double v)
+    {
+        return static_cast<uint32_t>(std::min(v * 0x1p32, double(UINT32_MAX)));
+    }
+
+    // Radical inverse of 'index' in prime BASE with Owen scrambling - each
+    // digit is permuted depending on 'seed' and the digits before it. The
+    // permutations are random affine maps, d * a + c modulo the base, which
+    // are cheap to draw from a hash. The base is a template argument so the
+    // divisions by it compile to multiplications.
+    template<uint32_t BASE>
+    uint32_t owen_scrambled_radical_inverse(uint32_t index, uint64_t seed)
+    {
+        double const inv_base = 1.0 / BASE;
+        double weight = 1;
+        uint64_t digits = 0;
+        for (uint64_t level = 0; weight > 0x1p-32; ++level)
+        {
+            uint32_t const digit = index % BASE;
+            index /= BASE;
+            uint64_t const digit_seed = mix_bits(seed ^ digits ^ (level << 56));
+            auto const a = 1 + static_cast<uint32_t>(((digit_seed & 0xffffffff) * (BASE - 1)) >> 32);
+            auto const c = static_cast<uint32_t>(((digit_seed >> 32) * BASE) >> 32);
+            digits = digits * BASE + (digit * a + c) % BASE;
+            weight *= inv_base;
+        }
+        return to_fraction(digits * weight);
+    }
+
+    using radical_inverse_t = uint32_t (*)(uint32_t index, uint64_t seed);
+
+    // Radical inverses in each of the bases
+    template<uint32_t... BASES>
+    constexpr std::array<radical_inverse_t, sizeof...(BASES)> radical_inverse_table()
+    {
+        return { &owen_scrambled_radical_inverse<BASES>... };
+    }
+
+    // Ranks of a tileable blue-noise texture made with void-and-cluster -
+    // see Ulichney, "The void-and-cluster method for dither array generation" (1993).
+    class blue_noise_tile_t final
+    {
+    public:
+        static constexpr int32_t size = 64;
+        static constexpr int32_t texel_count = size * size;
+
+    private:
+        std::vector<uint16_t> _ranks;
+
+    public:
+        static blue_noise_tile_t const& instance()
+        {
+            static blue_noise_tile_t const tile;
+            return tile;
+        }
+
+        // Rank of a texel in [0, texel_count). The tile repeats.
+        uint32_t rank(int64_t x, int64_t y) const
+        {
+            return _ranks[(y & (size - 1)) * size + (x & (size - 1))];
+        }
+
+    private:
+        blue_noise_tile_t()
+            : _ranks(texel_count)
+        {
+            // Gaussian falloff by toroidal offset
+            double const sigma = 1.5;
+            std::vector<double> falloff(texel_count);
+            for (int32_t dy = 0; dy < size; ++dy)
+            {
+                for (int32_t dx = 0; dx < size; ++dx)
+                {
+                    int32_t const x = std::min(dx, size - dx);
+                    int32_t const y = std::min(dy, size - dy);
+                    falloff[dy * size + dx] = std::exp(-(x * x + y * y) / (2 * sigma * sigma));
+                }
+            }
+
+            // Energy of each texel from the set texels around it
+            std::vector<uint8_t> set(texel_count);
+            std::vector<double> energy(texel_count);
+            auto toggle = [&](int32_t t, bool on)
+            {
+                set[t] = on;
+                int32_t const tx = t % size;
+                int32_t const ty = t / size;
+                double const sign = on ? 1 : -1;
+                for (int32_t y = 0; y < size; ++y)
+                {
+                    for (int32_t x = 0; x < size; ++x)
+                        energy[y * size + x] += sign * falloff[((y - ty) & (size - 1)) * size + ((x - tx) & (size - 1))];
+                }
+            };
+
+            // The set texel with the most energy and the unset one with the least
+            auto tightest_cluster = [&]
+            {
+                int32_t best = -1;
+                for (int32_t t = 0; t < texel_count; ++t)
+                {
+                    if (set[t] && (best < 0 || energy[t] > energy[best]))
+                        best = t;
+                }
+                return best;
+            };
+            auto largest_void = [&]
+            {
+                int32_t best = -1;
+                for (int32_t t = 0; t < texel_count; ++t)
+                {
+                    if (!set[t] && (best < 0 || energy[t] < energy[best]))
+                        best = t;
+                }
+                return best;
+            };
+
+            // Initial pattern - random texels moved from clusters to voids until stable
+            int32_t const initial_count = texel_count / 10;
+            rng_t rng{ 0 };
+            for (int32_t placed = 0; placed < initial_count;)
+            {
+                auto const t = static_cast<int32_t>(rng.next_u32() % texel_count);
+                if (!set[t])
+                {
+                    toggle(t, true);
+                    ++placed;
+                }
+            }
+
+            while (true)
+            {
+                int32_t const cluster = tightest_cluster();
+                toggle(cluster, false);
+                int32_t const found = largest_void();
+                toggle(found, true);
+                if (found == cluster)
+                    break;
+            }
+
+            // Ranks below the initial pattern - remove its tightest clusters first.
+            std::vector<uint8_t> const initial_set = set;
+            std::vector<double> const initial_energy = energy;
+            for (int32_t rank = initial_count - 1; rank >= 0; --rank)
+            {
+                int32_t const cluster = tightest_cluster();
+                toggle(cluster, false);
+                _ranks[cluster] = static_cast<uint16_t>(rank);
+            }
+
+            // Ranks above it - fill the largest voids first.
+            set = initial_set;
+            energy = initial_energy;
+            for (int32_t rank = initial_count; rank < texel_count; ++rank)
+            {
+                int32_t const found = largest_void();
+                toggle(found, true);
+                _ranks[found] = static_cast<uint16_t>(rank);
+            }
+        }
+    };
+}
+
+// Common part of the samplers - chooses between the sequence and padding.
+class sampler_t : public sample_sequence_t
+{
+    uint64_t _seed_hash;
+    uint32_t _sequence_bounces;
+    sample_padding_t _padding;
+    int32_t _width;
+public:
+    sampler_t(uint64_t seed, uint32_t sequence_bounces, sample_padding_t padding, int32_t width)
+        : _seed_hash{ sampling::mix_bits(seed) }
+        , _sequence_bounces{ sequence_bounces }
+        , _padding{ padding }
+        , _width{ width }
+    {
+        // Create the tile before the render threads need it.
+        if (padding == sample_padding_t::blue)
+            sampling::blue_noise_tile_t::instance();
+    }
+
+    virtual ~sampler_t() = default;
+
+    bool sample(uint64_t pixel, uint32_t index, uint32_t bounce, uint32_t draw, uint32_t& value) const override
+    {
+        if (draw >= sampled_draws)
+            return false;
+
+        uint32_t const dimension = bounce * sampled_draws + draw;
+        if (bounce < _sequence_bounces)
+        {
+            value = sequence_value(pixel, index, dimension);
+            return true;
+        }
+
+        if (_padding == sample_padding_t::blue)
+        {
+            value = blue_noise_value(pixel, index, dimension);
+            return true;
+        }
+        return false;
+    }
+
+protected:
+    // Value of a dimension covered by the sequence
+    virtual uint32_t sequence_value(uint64_t pixel, uint32_t index, uint32_t dimension) const = 0;
+
+    // Seed of a dimension of a pixel's samples. 'stream' tells apart seeds of different uses.
+    uint64_t dimension_seed(uint64_t pixel, uint32_t dimension, uint32_t stream = 0) const
+    {
+        using sampling::mix_bits;
+        return mix_bits(mix_bits(_seed_hash ^ pixel) ^ (static_cast<uint64_t>(stream) << 32 | dimension));
+    }
+
+private:
+    // Neighbouring pixels take values of a blue-noise tile, offset by a random
+    // amount for each dimension, so their errors are spread as blue noise.
+    // The samples of a pixel rotate the value by a van der Corput sequence,
+    // which stays stratified for any power of two samples. The sequence is
+    // shuffled for each dimension but not for each pixel, as that would
+    // undo the blue noise.
+    uint32_t blue_noise_value(uint64_t pixel, uint32_t index, uint32_t dimension) const
+    {
+        using namespace sampling;
+        using tile_t = blue_noise_tile_t;
+
+        uint64_t const dimension_hash = mix_bits(_seed_hash ^ dimension);
+        auto const x = static_cast<int64_t>(pixel % static_cast<uint64_t>(_width)) + static_cast<int64_t>(dimension_hash & (tile_t::size - 1));
+        auto const y = static_cast<int64_t>(pixel / static_cast<uint64_t>(_width)) + static_cast<int64_t>((dimension_hash >> 8) & (tile_t::size - 1));
+
+        // The rank picks one of 4096 strata, the pixel's hash the point within it.
+        uint32_t const rank = tile_t::instance().rank(x, y);
+        auto const jitter = static_cast<uint32_t>(dimension_seed(pixel, dimension, 1) >> 44);
+        uint32_t const value = (rank << 20) | jitter;
+
+        uint32_t const rotation = reverse_bits(owen_scramble(index, static_cast<uint32_t>(dimension_hash >> 32)));
+        return value + rotation;
+    }
+};
+
+// Random values - only the padding, if any, differs from the sample's stream.
+class random_sampler_t final : public sampler_t
+{
+public:
+    random_sampler_t(uint64_t seed, sample_padding_t padding, int32_t width)
+        : sampler_t{ seed, 0, padding, width }
+    { }
+
+protected:
+    uint32_t sequence_value(uint64_t, uint32_t, uint32_t) const override
+    {
+        return 0;
+    }
+};
+
+// Correlated multi-jittered samples. Each pair of dimensions is stratified
+// into a grid of about sqrt(N) by sqrt(N) cells for N samples per pixel,
+// with one sample per row and column of the finer N by N grid. The pattern
+// depends on N, so every pixel must take the same number of samples for
+// the strata to be filled.
+class stratified_sampler_t final : public sampler_t
+{
+    uint32_t _samples_per_pixel;
+public:
+    stratified_sampler_t(uint64_t seed, sample_padding_t padding, int32_t width, uint32_t samples_per_pixel)
+        : sampler_t{ seed, sequence_bounces, padding, width }
+        , _samples_per_pixel{ samples_per_pixel }
+    { }
+
+protected:
+    uint32_t sequence_value(uint64_t pixel, uint32_t index, uint32_t dimension) const override
+    {
+        using sampling::permute;
+        using sampling::random_fraction;
+
+        uint32_t const count = _samples_per_pixel;
+        auto const p = static_cast<uint32_t>(dimension_seed(pixel, dimension / 2));
+        if (index >= count)
+            return random_fraction(index, p);
+
+        auto const m = static_cast<uint32_t>(std::sqrt(static_cast<double>(count)));
+        uint32_t const n = (count + m - 1) / m;
+        uint32_t const s = permute(index, count, p * 0x51633e2d);
+        if (dimension % 2 == 0)
+        {
+            uint32_t const sx = permute(s % m, m, p * 0x68bc21eb);
+            uint32_t const sy = permute(s / m, n, p * 0x02e5be93);
+            double const jx = random_fraction(s, p * 0x967a889b) * 0x1p-32;
+            return sampling::to_fraction((sx + (sy + jx) / n) / m);
+        }
+
+        double const jy = random_fraction(s, p * 0x368cc8b7) * 0x1p-32;
+        return sampling::to_fraction((s + jy) / count);
+    }
+};
+
+// Halton sequence - dimension d is the radical inverse in the d-th prime.
+// Digits are Owen scrambled with a seed per pixel and dimension, which
+// decorrelates pixels and breaks up the patterns of the larger primes.
+class halton_sampler_t final : public sampler_t
+{
+    // Radical inverse of each dimension
+    static constexpr auto _radical_inverses = sampling::radical_inverse_table<
+        2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+        59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131>();
+    static_assert(_radical_inverses.size() == sequence_bounces * sampled_draws);
+public:
+    halton_sampler_t(uint64_t seed, sample_padding_t padding, int32_t width)
+        : sampler_t{ seed, sequence_bounces, padding, width }
+    { }
+
+protected:
+    uint32_t sequence_value(uint64_t pixel, uint32_t index, uint32_t dimension) const override
+    {
+        uint64_t const seed = dimension_seed(pixel, dimension);
+        if (dimension == 0)
+            return sampling::owen_scramble(sampling::reverse_bits(index), static_cast<uint32_t>(seed));
+        return _radical_inverses[dimension](index, seed);
+    }
+};
+
+// The first two dimensions of the Sobol sequence form a (0,2)-sequence:
+// any power of two samples is stratified in every grid of that many
+// cells. Each pair of dimensions takes its own shuffle of the sequence -
+// padding, as the higher Sobol dimensions are less well distributed - and
+// the values are Owen scrambled. See Burley (2020).
+class sobol_sampler_t final : public sampler_t
+{
+public:
+    sobol_sampler_t(uint64_t seed, sample_padding_t padding, int32_t width)
+        : sampler_t{ seed, sequence_bounces, padding, width }
+    { }
+
+protected:
+    uint32_t sequence_value(uint64_t pixel, uint32_t index, uint32_t dimension) const override
+    {
+        using namespace sampling;
+
+        // Both dimensions of a pair must take the same shuffle.
+        auto const shuffle_seed = static_cast<uint32_t>(dimension_seed(pixel, dimension / 2, 1));
+        uint32_t const shuffled = owen_scramble(index, shuffle_seed);
+        uint32_t const value = dimension % 2 == 0 ? reverse_bits(shuffled) : sobol_second_dimension(shuffled);
+        return owen_scramble(value, static_cast<uint32_t>(dimension_seed(pixel, dimension)));
+    }
+};
+
+// Create the sampler for an image 'width' pixels wide.
+// Returns null for random values without padding - the plain sample streams.
+inline std::unique_ptr<sampler_t> create_sampler(
+    sampler_kind_t kind,
+    sample_padding_t padding,
+    uint64_t seed,
+    int32_t width,
+    uint32_t samples_per_pixel)
+{
+    switch (kind)
+    {
+    case sampler_kind_t::stratified:
+        return std::make_unique<stratified_sampler_t>(seed, padding, width, samples_per_pixel);
+    case sampler_kind_t::halton:
+        return std::make_unique<halton_sampler_t>(seed, padding, width);
+    case sampler_kind_t::sobol:
+        return std::make_unique<sobol_sampler_t>(seed, padding, width);
+    default:
+        if (padding == sample_padding_t::white)
+            return nullptr;
+        return std::make_unique<random_sampler_t>(seed, padding, width);
+    }
+}
+
+// Identifies the values a sampler produces, e.g. to check a checkpoint
+// is resumed with the sampler it was started with. Zero for random values.
+inline uint64_t sampler_signature(sampler_kind_t kind, sample_padding_t padding, uint32_t samples_per_pixel)
+{
+    // Stratified patterns depend on the number of samples.
+    uint64_t const count = kind == sampler_kind_t::stratified ? samples_per_pixel : 0;
+    return static_cast<uint64_t>(kind) | (static_cast<uint64_t>(padding) << 8) | (count << 32);
+}
+
+#endif // _SRC_INC_SAMPLER_HPP_
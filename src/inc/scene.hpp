@@ -0,0 +1,127 @@
+#ifndef _SRC_INC_SCENE_HPP_
+#define _SRC_INC_SCENE_HPP_
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "elements.hpp"
+#include "instance.hpp"
+#include "materials.hpp"
+#include "shapes.hpp"
+
+// Owns every primitive and material of a scene.
+// Objects are placement-constructed in a monotonic arena, so building a
+// scene costs a pointer bump per object instead of a heap allocation and
+// objects added together sit next to each other in memory. Everything is
+// released in one shot when the scene is destroyed.
+//
+// Materials have their own arena so they form a contiguous table.
+//
+// The add functions return handles - plain pointers that stay valid for
+// the lifetime of the scene.
+//
+// Geometry repeated across the scene is added once as a prototype, which
+// is owned but not part of the world, and placed by instances of it.
+template<typename T>
+class sceneT_t final
+{
+#ifdef ART_MATERIAL_VARIANT
+    using material_t = material_variantT_t<T>;
+#else
+    using material_t = materialT_t<T>;
+#endif // ART_MATERIAL_VARIANT
+
+    std::pmr::monotonic_buffer_resource _arena;
+    std::pmr::monotonic_buffer_resource _material_arena;
+    std::vector<material_t*> _materials;
+    std::vector<sphereT_t<T> const*> _spheres;
+    std::vector<hittableT_t<T>*> _owned; // Every hittable in the arena, in creation order
+    hittableT_list_t<T> _world;
+public:
+    using material_handle_t = material_handleT_t<T>;
+    using sphere_handle_t = sphereT_t<T> const*;
+
+    // The arena grows geometrically from the initial size.
+    explicit sceneT_t(size_t initial_arena_size = 64 * 1024)
+        : _arena{ initial_arena_size }
+        , _material_arena{ initial_arena_size / 4 }
+    { }
+
+    sceneT_t(sceneT_t const&) = delete;
+    sceneT_t& operator=(sceneT_t const&) = delete;
+
+    ~sceneT_t()
+    {
+        // The arena only releases memory - run the destructors first.
+        for (auto iter = _owned.rbegin(); iter != _owned.rend(); ++iter)
+            (*iter)->~hittableT_t();
+        for (auto iter = _materials.rbegin(); iter != _materials.rend(); ++iter)
+            (*iter)->~material_t();
+    }
+
+    // Create a material in the scene.
+    template<typename MATERIAL, typename... ARGS>
+    material_handle_t add_material(ARGS&&... args)
+    {
+#ifdef ART_MATERIAL_VARIANT
+        material_t* material = create<material_t>(_material_arena, std::in_place_type<MATERIAL>, std::forward<ARGS>(args)...);
+#else
+        material_t* material = create<MATERIAL>(_material_arena, std::forward<ARGS>(args)...);
+#endif // ART_MATERIAL_VARIANT
+        _materials.push_back(material);
+        return material;
+    }
+
+    // Create a sphere and add it to the world.
+    sphere_handle_t add_sphere(point3T_t<T> center, T radius, material_handle_t material)
+    {
+        sphere_handle_t sphere = add<sphereT_t<T>>(center, radius, material);
+        _spheres.push_back(sphere);
+        return sphere;
+    }
+
+    // Create a hittable and add it to the world.
+    template<typename HITTABLE, typename... ARGS>
+    HITTABLE const* add(ARGS&&... args)
+    {
+        HITTABLE* hittable = create<HITTABLE>(_arena, std::forward<ARGS>(args)...);
+        _owned.push_back(hittable);
+        _world.add(hittable);
+        return hittable;
+    }
+
+    // Create a hittable that is not in the world - e.g. the shared child of instances.
+    template<typename HITTABLE, typename... ARGS>
+    HITTABLE const* add_prototype(ARGS&&... args)
+    {
+        HITTABLE* hittable = create<HITTABLE>(_arena, std::forward<ARGS>(args)...);
+        _owned.push_back(hittable);
+        return hittable;
+    }
+
+    // Place a copy of 'child', e.g. a prototype, in the world - optionally
+    // with 'material' in place of the child's materials.
+    instanceT_t<T> const* add_instance(hittableT_t<T> const* child, transformT_t<T> const& transform, material_handle_t material = nullptr)
+    {
+        return add<instanceT_t<T>>(child, transform, material);
+    }
+
+    // All hittables in the world
+    hittableT_list_t<T> const& world() const { return _world; }
+
+    std::vector<sphere_handle_t> const& spheres() const { return _spheres; }
+    size_t material_count() const { return _materials.size(); }
+
+private:
+    template<typename U, typename... ARGS>
+    static U* create(std::pmr::memory_resource& arena, ARGS&&... args)
+    {
+        void* memory = arena.allocate(sizeof(U), alignof(U));
+        return new (memory) U(std::forward<ARGS>(args)...);
+    }
+};
+
+#endif // _SRC_INC_SCENE_HPP_
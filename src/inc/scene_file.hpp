@@ -0,0 +1,925 @@
+#ifndef _SRC_INC_SCENE_FILE_HPP_
+#define _SRC_INC_SCENE_FILE_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <filesystem>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "vec3.hpp"
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "elements.hpp"
+#include "mapped_file.hpp"
+#include "materials.hpp"
+#include "mesh.hpp"
+#include "scene.hpp"
+#include "sphere_bvh.hpp"
+
+// Scene description files.
+//
+// Scenes are written as text, one statement per line. '#' starts a comment.
+//
+//   camera lookfrom 13 2 3 lookat 0 0 0 vup 0 1 0 vfov 20 aperture 0.1 focus 10
+//   material lambertian 0.5 0.5 0.5     # albedo
+//   material hemisphere 0.2 0.4 0.1     # albedo
+//   material simple 0.2 0.4 0.1         # albedo
+//   material metal 0.7 0.6 0.5 0.1      # albedo, fuzz
+//   material dielectric 1.5             # index of refraction
+//   sphere 0 -1000 0 1000 0             # center, radius, material
+//   mesh bunny.obj 0 scale 2 rotate 0 1 0 90 translate 1 0 0   # OBJ file, material, placement
+//
+// Materials are numbered from 0 in the order they are declared and must be
+// declared before they are used. Every camera key is optional - missing keys
+// keep the camera of random_scene().
+//
+// Meshes are OBJ files (see obj_parserT_t), relative to the scene file's
+// directory. The placement keys are optional and apply in the order written.
+// A file is loaded once and shared by the meshes that use it - further
+// meshes are instances of it.
+//
+// Scenes are rendered from a binary form that is mapped into memory and
+// used in place - see scene_binary_header_t. Parsing the text is the slow
+// part of loading, so the binary form of a text file is saved next to it
+// ("<file>.cache") and used for as long as the size and modification time
+// of the text file match.
+
+// Camera placement - defaults to the camera of random_scene()
+struct camera_record_t final
+{
+    double lookfrom[3] = { 13, 2, 3 };
+    double lookat[3] = { 0, 0, 0 };
+    double vup[3] = { 0, 1, 0 };
+    double vfov = 20; // Vertical field-of-view in degrees
+    double aperture = 0.1;
+    double focus = 10;
+};
+
+// A camera needs finite values, a field of view in (0, 180) degrees, a
+// positive focus distance, no negative aperture and somewhere to look.
+inline bool is_valid_camera(camera_record_t const& camera)
+{
+    auto const finite = [](double const* v) { return std::isfinite(v[0]) && std::isfinite(v[1]) && std::isfinite(v[2]); };
+    return finite(camera.lookfrom) && finite(camera.lookat) && finite(camera.vup)
+        && (camera.lookfrom[0] != camera.lookat[0] || camera.lookfrom[1] != camera.lookat[1] || camera.lookfrom[2] != camera.lookat[2])
+        && camera.vfov > 0 && camera.vfov < 180
+        && camera.focus > 0 && std::isfinite(camera.focus)
+        && camera.aperture >= 0 && std::isfinite(camera.aperture);
+}
+
+struct material_record_t final
+{
+    uint32_t kind; // material_kind_t
+    float values[4]; // Albedo and fuzz, or index of refraction
+};
+
+// Albedo, fuzz and index of refraction are all finite and non-negative.
+// Unused values are zero.
+inline bool is_valid_material(material_record_t const& material)
+{
+    return material.kind < static_cast<uint32_t>(material_kind_t::count)
+        && std::all_of(std::begin(material.values), std::end(material.values), [](float v) { return std::isfinite(v) && v >= 0; });
+}
+
+struct sphere_record_t final
+{
+    float center[3];
+    float radius;
+    uint32_t material;
+};
+
+// A sphere needs a finite center and a finite, positive radius,
+// otherwise its bounds poison the BVH.
+inline bool is_valid_sphere(float const* center, float radius)
+{
+    return std::isfinite(center[0]) && std::isfinite(center[1]) && std::isfinite(center[2])
+        && std::isfinite(radius) && radius > 0;
+}
+
+struct mesh_record_t final
+{
+    uint64_t path_offset; // Path of the OBJ file in the strings
+    uint32_t path_size;
+    uint32_t material;
+    double transform[3][4]; // Object to scene - see transformT_t
+    double inverse[3][4];
+};
+
+// Scene as stored in a file
+struct scene_file_t final
+{
+    camera_record_t camera;
+    std::vector<material_record_t> materials;
+    std::vector<sphere_record_t> spheres;
+    std::vector<mesh_record_t> meshes;
+    std::string strings; // Mesh paths
+};
+
+// Header of a binary scene file.
+// The header is followed by flat arrays, each at the offset recorded here
+// and aligned to a cache line, so the file can be rendered from directly
+// where it is mapped:
+//
+//   materials          material_record_t per material
+//   spheres            Center x, y, z and radius of each sphere (float)
+//   sphere_materials   Material index of each sphere (uint32_t)
+//   nodes              Optional prebuilt BVH (bvh_nodeT_t<float>)
+//   meshes             mesh_record_t per mesh
+//   strings            Mesh paths, not terminated
+//
+// With a BVH the spheres are stored in leaf order - the offset and count
+// of a leaf are a range of spheres.
+struct scene_binary_header_t final
+{
+    static constexpr char magic_value[8] = { 'A', 'R', 'T', 'S', 'C', 'N', 0, 0 };
+    static constexpr uint32_t current_version = 3;
+    static constexpr uint64_t section_alignment = 64;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t element_size; // Size of a sphere value - float
+    uint64_t file_size;
+    uint64_t source_size; // Size of the text file the scene was made from, 0 if none
+    int64_t source_time; // Modification time of the text file
+    uint64_t material_count;
+    uint64_t sphere_count;
+    uint64_t node_count; // 0 without a BVH
+    uint64_t mesh_count;
+    uint64_t strings_size;
+    uint64_t materials_offset;
+    uint64_t spheres_offset;
+    uint64_t sphere_materials_offset;
+    uint64_t nodes_offset;
+    uint64_t meshes_offset;
+    uint64_t strings_offset;
+    camera_record_t camera;
+};
+
+// Parser for the text format.
+// Numbers are read with std::from_chars - no locale, no allocation.
+class scene_parser_t final
+{
+    char const* _pos;
+    char const* _end;
+    int32_t _line;
+    std::string _error;
+public:
+    scene_parser_t(char const* text, size_t size)
+        : _pos{ text }
+        , _end{ text + size }
+        , _line{ 1 }
+    { }
+
+    std::string const& error() const { return _error; }
+
+    bool parse(scene_file_t& scene)
+    {
+        std::string_view keyword;
+        while (next_statement(keyword))
+        {
+            bool parsed;
+            if (keyword == "sphere")
+                parsed = parse_sphere(scene);
+            else if (keyword == "material")
+                parsed = parse_material(scene);
+            else if (keyword == "mesh")
+                parsed = parse_mesh(scene);
+            else if (keyword == "camera")
+                parsed = parse_camera(scene.camera);
+            else
+                parsed = fail("unknown statement");
+
+            if (!parsed || !end_statement())
+                return false;
+        }
+        return _error.empty();
+    }
+
+private:
+    bool fail(char const* message)
+    {
+        if (_error.empty())
+            _error = "line " + std::to_string(_line) + ": " + message;
+        return false;
+    }
+
+    void skip_blank()
+    {
+        while (_pos != _end && (*_pos == ' ' || *_pos == '\t' || *_pos == '\r'))
+            ++_pos;
+        if (_pos != _end && *_pos == '#')
+        {
+            while (_pos != _end && *_pos != '\n')
+                ++_pos;
+        }
+    }
+
+    // Find the keyword of the next statement, skipping empty lines.
+    bool next_statement(std::string_view& keyword)
+    {
+        while (true)
+        {
+            skip_blank();
+            if (_pos == _end)
+                return false;
+            if (*_pos != '\n')
+                return next_token(keyword);
+            ++_pos;
+            ++_line;
+        }
+    }
+
+    bool end_statement()
+    {
+        skip_blank();
+        if (_pos == _end)
+            return true;
+        if (*_pos != '\n')
+            return fail("unexpected value at end of line");
+        ++_pos;
+        ++_line;
+        return true;
+    }
+
+    bool next_token(std::string_view& token)
+    {
+        skip_blank();
+        char const* begin = _pos;
+        while (_pos != _end && *_pos != ' ' && *_pos != '\t' && *_pos != '\r' && *_pos != '\n' && *_pos != '#')
+            ++_pos;
+        token = { begin, static_cast<size_t>(_pos - begin) };
+        return !token.empty();
+    }
+
+    template<typename N>
+    bool next_number(N& value)
+    {
+        skip_blank();
+        auto [end, ec] = std::from_chars(_pos, _end, value);
+        if (ec != std::errc{})
+            return fail("expected a number");
+        _pos = end;
+        return true;
+    }
+
+    template<typename N>
+    bool next_numbers(N* values, int32_t count)
+    {
+        for (int32_t i = 0; i < count; ++i)
+        {
+            if (!next_number(values[i]))
+                return false;
+        }
+        return true;
+    }
+
+    bool parse_sphere(scene_file_t& scene)
+    {
+        sphere_record_t sphere;
+        if (!next_numbers(sphere.center, 3) || !next_number(sphere.radius) || !next_number(sphere.material))
+            return false;
+        if (!is_valid_sphere(sphere.center, sphere.radius))
+            return fail("invalid sphere");
+        if (sphere.material >= scene.materials.size())
+            return fail("undeclared material");
+        scene.spheres.push_back(sphere);
+        return true;
+    }
+
+    bool parse_mesh(scene_file_t& scene)
+    {
+        using transform_t = transformT_t<double>;
+
+        std::string_view path;
+        mesh_record_t mesh{};
+        if (!next_token(path))
+            return fail("expected a mesh file");
+        if (!next_number(mesh.material))
+            return false;
+        if (mesh.material >= scene.materials.size())
+            return fail("undeclared material");
+
+        transform_t transform;
+        std::string_view key;
+        while (next_token(key))
+        {
+            double values[4];
+            if (key == "translate")
+            {
+                if (!next_numbers(values, 3))
+                    return false;
+                transform = transform_t::translate({ values[0], values[1], values[2] }) * transform;
+            }
+            else if (key == "rotate")
+            {
+                if (!next_numbers(values, 4))
+                    return false;
+                if (values[0] == 0 && values[1] == 0 && values[2] == 0)
+                    return fail("rotation without an axis");
+                transform = transform_t::rotate({ values[0], values[1], values[2] }, values[3]) * transform;
+            }
+            else if (key == "scale")
+            {
+                if (!next_number(values[0]))
+                    return false;
+                if (values[0] == 0)
+                    return fail("scale of zero");
+                transform = transform_t::scale(values[0]) * transform;
+            }
+            else
+            {
+                return fail("unknown mesh key");
+            }
+        }
+
+        std::copy_n(&transform.matrix()[0][0], 12, &mesh.transform[0][0]);
+        std::copy_n(&transform.inverse_matrix()[0][0], 12, &mesh.inverse[0][0]);
+        mesh.path_offset = scene.strings.size();
+        mesh.path_size = static_cast<uint32_t>(path.size());
+        scene.strings.append(path);
+        scene.meshes.push_back(mesh);
+        return true;
+    }
+
+    bool parse_material(scene_file_t& scene)
+    {
+        std::string_view type;
+        if (!next_token(type))
+            return fail("expected a material type");
+
+        material_record_t material{};
+        bool parsed;
+        if (type == "lambertian")
+        {
+            material.kind = static_cast<uint32_t>(material_kind_t::diffuse_lambertian);
+            parsed = next_numbers(material.values, 3);
+        }
+        else if (type == "hemisphere")
+        {
+            material.kind = static_cast<uint32_t>(material_kind_t::diffuse_hemisphere);
+            parsed = next_numbers(material.values, 3);
+        }
+        else if (type == "simple")
+        {
+            material.kind = static_cast<uint32_t>(material_kind_t::diffuse_simple);
+            parsed = next_numbers(material.values, 3);
+        }
+        else if (type == "metal")
+        {
+            material.kind = static_cast<uint32_t>(material_kind_t::metal);
+            parsed = next_numbers(material.values, 4);
+        }
+        else if (type == "dielectric")
+        {
+            material.kind = static_cast<uint32_t>(material_kind_t::dielectric);
+            parsed = next_numbers(material.values, 1);
+        }
+        else
+        {
+            return fail("unknown material type");
+        }
+
+        if (!parsed)
+            return false;
+        if (!is_valid_material(material))
+            return fail("invalid material");
+        scene.materials.push_back(material);
+        return true;
+    }
+
+    bool parse_camera(camera_record_t& camera)
+    {
+        std::string_view key;
+        while (next_token(key))
+        {
+            bool parsed;
+            if (key == "lookfrom")
+                parsed = next_numbers(camera.lookfrom, 3);
+            else if (key == "lookat")
+                parsed = next_numbers(camera.lookat, 3);
+            else if (key == "vup")
+                parsed = next_numbers(camera.vup, 3);
+            else if (key == "vfov")
+                parsed = next_number(camera.vfov);
+            else if (key == "aperture")
+                parsed = next_number(camera.aperture);
+            else if (key == "focus")
+                parsed = next_number(camera.focus);
+            else
+                parsed = fail("unknown camera key");
+
+            if (!parsed)
+                return false;
+        }
+        if (!is_valid_camera(camera))
+            return fail("invalid camera");
+        return true;
+    }
+};
+
+// Read a whole file. Returns false if it cannot be read.
+inline bool read_file(std::filesystem::path const& path, std::vector<char>& contents)
+{
+    std::FILE* file = std::fopen(path.string().c_str(), "rb");
+    if (file == nullptr)
+        return false;
+
+    std::error_code ec;
+    auto const size = std::filesystem::file_size(path, ec);
+    bool read = !ec;
+    if (read)
+    {
+        contents.resize(static_cast<size_t>(size));
+        read = std::fread(contents.data(), 1, contents.size(), file) == contents.size();
+    }
+    std::fclose(file);
+    return read;
+}
+
+// Lay out a scene in the binary format, with a BVH over its spheres.
+// 'source_size' and 'source_time' identify the text file it was parsed from.
+inline std::unique_ptr<std::byte[]> create_scene_binary(scene_file_t const& scene, uint64_t source_size, int64_t source_time, size_t& size)
+{
+    using header_t = scene_binary_header_t;
+
+    sphere_bvh_dataT_t<float> sphere_data;
+    for (sphere_record_t const& sphere : scene.spheres)
+        sphere_data.add({ sphere.center[0], sphere.center[1], sphere.center[2] }, sphere.radius, sphere.material);
+    sphere_data.build();
+
+    header_t header{};
+    std::memcpy(header.magic, header_t::magic_value, sizeof(header.magic));
+    header.version = header_t::current_version;
+    header.element_size = sizeof(float);
+    header.source_size = source_size;
+    header.source_time = source_time;
+    header.material_count = scene.materials.size();
+    header.sphere_count = scene.spheres.size();
+    header.node_count = sphere_data.nodes.size();
+    header.mesh_count = scene.meshes.size();
+    header.strings_size = scene.strings.size();
+    header.camera = scene.camera;
+
+    uint64_t offset = sizeof(header_t);
+    auto const place = [&](uint64_t& section, uint64_t section_size)
+    {
+        section = (offset + header_t::section_alignment - 1) / header_t::section_alignment * header_t::section_alignment;
+        offset = section + section_size;
+    };
+    place(header.materials_offset, sizeof(material_record_t) * header.material_count);
+    place(header.spheres_offset, 4 * sizeof(float) * header.sphere_count);
+    place(header.sphere_materials_offset, sizeof(uint32_t) * header.sphere_count);
+    place(header.nodes_offset, sizeof(bvh_nodeT_t<float>) * header.node_count);
+    place(header.meshes_offset, sizeof(mesh_record_t) * header.mesh_count);
+    place(header.strings_offset, header.strings_size);
+    header.file_size = offset;
+
+    // Zeroed, so padding is written deterministically.
+    size = static_cast<size_t>(header.file_size);
+    auto data = std::make_unique<std::byte[]>(size);
+    std::memcpy(data.get(), &header, sizeof(header));
+    std::memcpy(data.get() + header.materials_offset, scene.materials.data(), sizeof(material_record_t) * scene.materials.size());
+    std::memcpy(data.get() + header.spheres_offset, sphere_data.spheres.data(), sizeof(float) * sphere_data.spheres.size());
+    std::memcpy(data.get() + header.sphere_materials_offset, sphere_data.sphere_materials.data(), sizeof(uint32_t) * sphere_data.sphere_materials.size());
+    std::memcpy(data.get() + header.nodes_offset, sphere_data.nodes.data(), sizeof(bvh_nodeT_t<float>) * sphere_data.nodes.size());
+    std::memcpy(data.get() + header.meshes_offset, scene.meshes.data(), sizeof(mesh_record_t) * scene.meshes.size());
+    std::memcpy(data.get() + header.strings_offset, scene.strings.data(), scene.strings.size());
+    return data;
+}
+
+// Scene in the binary format - a file mapped into memory, or the same
+// layout in memory when a text file was parsed. Nothing is copied out of
+// it, so a scene loads in the time it takes to check it.
+class mapped_scene_t final
+{
+    mapped_file_t _file;
+    std::unique_ptr<std::byte[]> _memory;
+    std::byte const* _data = nullptr;
+public:
+    mapped_scene_t() = default;
+
+    mapped_scene_t(mapped_scene_t const&) = delete;
+    mapped_scene_t& operator=(mapped_scene_t const&) = delete;
+
+    // Map a binary scene file. On failure 'error' describes the problem.
+    bool map(char const* path, std::string& error)
+    {
+        close();
+        if (!_file.map_read(path))
+        {
+            error = std::string{ "cannot map " } + path;
+            return false;
+        }
+        return set_data(static_cast<std::byte const*>(_file.data()), _file.size(), error);
+    }
+
+    // Take ownership of a scene created by create_scene_binary().
+    bool attach(std::unique_ptr<std::byte[]> data, size_t size, std::string& error)
+    {
+        close();
+        _memory = std::move(data);
+        return set_data(_memory.get(), size, error);
+    }
+
+    void close()
+    {
+        _file.close();
+        _memory.reset();
+        _data = nullptr;
+    }
+
+    scene_binary_header_t const& header() const { return *reinterpret_cast<scene_binary_header_t const*>(_data); }
+    camera_record_t const& camera() const { return header().camera; }
+
+    size_t material_count() const { return static_cast<size_t>(header().material_count); }
+    size_t sphere_count() const { return static_cast<size_t>(header().sphere_count); }
+    size_t node_count() const { return static_cast<size_t>(header().node_count); }
+    size_t mesh_count() const { return static_cast<size_t>(header().mesh_count); }
+
+    material_record_t const* materials() const { return section<material_record_t>(header().materials_offset); }
+
+    // Center and radius of each sphere - 4 values per sphere
+    float const* spheres() const { return section<float>(header().spheres_offset); }
+    uint32_t const* sphere_materials() const { return section<uint32_t>(header().sphere_materials_offset); }
+    bvh_nodeT_t<float> const* nodes() const { return section<bvh_nodeT_t<float>>(header().nodes_offset); }
+    mesh_record_t const* meshes() const { return section<mesh_record_t>(header().meshes_offset); }
+
+    std::string_view mesh_path(size_t i) const
+    {
+        mesh_record_t const& mesh = meshes()[i];
+        return { section<char>(header().strings_offset) + mesh.path_offset, mesh.path_size };
+    }
+
+    // Write the scene to a binary scene file of its own.
+    // Relative mesh paths are taken from 'directory' and rewritten to be
+    // relative to the saved file, so they still resolve when it is loaded.
+    bool save(char const* path, std::filesystem::path const& directory) const
+    {
+        // The strings are the last section - only the meshes and the strings change.
+        scene_binary_header_t header = this->header();
+        std::vector<mesh_record_t> meshes(this->meshes(), this->meshes() + mesh_count());
+        std::string strings;
+        std::error_code ec;
+        std::filesystem::path const file_directory = std::filesystem::absolute(path, ec).parent_path();
+        if (ec)
+            return false;
+        for (size_t i = 0; i < meshes.size(); ++i)
+        {
+            std::filesystem::path mesh_file{ mesh_path(i) };
+            if (mesh_file.is_relative())
+            {
+                mesh_file = std::filesystem::absolute(directory / mesh_file, ec);
+                if (ec)
+                    return false;
+                // No relative path between different roots - keep it absolute.
+                std::filesystem::path const relative = std::filesystem::relative(mesh_file, file_directory, ec);
+                if (!ec && !relative.empty())
+                    mesh_file = relative;
+            }
+            std::string const name = mesh_file.generic_string();
+            meshes[i].path_offset = strings.size();
+            meshes[i].path_size = static_cast<uint32_t>(name.size());
+            strings.append(name);
+        }
+
+        // The file does not come from a text file.
+        header.source_size = 0;
+        header.source_time = 0;
+        header.strings_size = strings.size();
+        header.file_size = header.strings_offset + header.strings_size;
+
+        std::FILE* file = std::fopen(path, "wb");
+        if (file == nullptr)
+            return false;
+
+        std::vector<std::byte> const padding(header.strings_offset - header.meshes_offset - sizeof(mesh_record_t) * meshes.size());
+        bool saved = std::fwrite(&header, sizeof(header), 1, file) == 1
+            && std::fwrite(_data + sizeof(header), 1, header.meshes_offset - sizeof(header), file) == header.meshes_offset - sizeof(header)
+            && std::fwrite(meshes.data(), sizeof(mesh_record_t), meshes.size(), file) == meshes.size()
+            && std::fwrite(padding.data(), 1, padding.size(), file) == padding.size()
+            && std::fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+        return std::fclose(file) == 0 && saved;
+    }
+
+private:
+    template<typename U>
+    U const* section(uint64_t offset) const
+    {
+        return reinterpret_cast<U const*>(_data + offset);
+    }
+
+    bool set_data(std::byte const* data, size_t size, std::string& error)
+    {
+        _data = data;
+        if (!validate(size, error))
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // Check the header and every index in the scene, so a damaged
+    // file is rejected here rather than read out of bounds while rendering.
+    bool validate(size_t size, std::string& error) const
+    {
+        using header_t = scene_binary_header_t;
+
+        error = "not a scene file or a different version";
+        if (size < sizeof(header_t))
+            return false;
+
+        header_t const& h = header();
+        if (std::memcmp(h.magic, header_t::magic_value, sizeof(h.magic)) != 0
+            || h.version != header_t::current_version
+            || h.element_size != sizeof(float))
+        {
+            return false;
+        }
+
+        error = "damaged scene file";
+        auto const fits = [&](uint64_t offset, uint64_t count, uint64_t element_size, uint64_t alignment)
+        {
+            return offset % alignment == 0
+                && offset >= sizeof(header_t)
+                && offset <= size
+                && count <= (size - offset) / element_size;
+        };
+        if (h.file_size != size
+            || h.sphere_count > std::numeric_limits<uint32_t>::max()
+            || h.node_count > 2 * h.sphere_count
+            || !fits(h.materials_offset, h.material_count, sizeof(material_record_t), alignof(material_record_t))
+            || !fits(h.spheres_offset, h.sphere_count, 4 * sizeof(float), alignof(float))
+            || !fits(h.sphere_materials_offset, h.sphere_count, sizeof(uint32_t), alignof(uint32_t))
+            || !fits(h.nodes_offset, h.node_count, sizeof(bvh_nodeT_t<float>), alignof(bvh_nodeT_t<float>))
+            || !fits(h.meshes_offset, h.mesh_count, sizeof(mesh_record_t), alignof(mesh_record_t))
+            || !fits(h.strings_offset, h.strings_size, 1, 1)
+            || !is_valid_camera(h.camera))
+        {
+            return false;
+        }
+
+        material_record_t const* materials = this->materials();
+        for (size_t i = 0; i < material_count(); ++i)
+        {
+            if (!is_valid_material(materials[i]))
+                return false;
+        }
+
+        float const* spheres = this->spheres();
+        uint32_t const* sphere_materials = this->sphere_materials();
+        for (size_t i = 0; i < sphere_count(); ++i)
+        {
+            if (!is_valid_sphere(spheres + 4 * i, spheres[4 * i + 3]))
+                return false;
+            if (sphere_materials[i] >= h.material_count)
+                return false;
+        }
+
+        mesh_record_t const* meshes = this->meshes();
+        for (size_t i = 0; i < mesh_count(); ++i)
+        {
+            if (meshes[i].material >= h.material_count
+                || meshes[i].path_offset > h.strings_size
+                || meshes[i].path_size > h.strings_size - meshes[i].path_offset)
+            {
+                return false;
+            }
+        }
+
+        // Children follow their parent, so one pass finds every depth.
+        bvh_nodeT_t<float> const* nodes = this->nodes();
+        std::vector<uint8_t> depths(node_count());
+        for (size_t i = 0; i < node_count(); ++i)
+        {
+            bvh_nodeT_t<float> const& node = nodes[i];
+            auto const offset = static_cast<uint64_t>(static_cast<uint32_t>(node.offset));
+            if (node.is_leaf())
+            {
+                if (offset + node.count > h.sphere_count)
+                    return false;
+            }
+            else if (offset <= i || offset + 1 >= h.node_count || node.axis > 2 || depths[i] + 1 >= bvh_builderT_t<float>::max_depth)
+            {
+                return false;
+            }
+            else
+            {
+                depths[offset] = depths[offset + 1] = static_cast<uint8_t>(depths[i] + 1);
+            }
+        }
+
+        error.clear();
+        return true;
+    }
+};
+
+inline std::filesystem::path scene_cache_path(std::filesystem::path const& path)
+{
+    std::filesystem::path cache = path;
+    cache += ".cache";
+    return cache;
+}
+
+// True if the file starts like a binary scene file.
+inline bool is_scene_binary(std::filesystem::path const& path)
+{
+    std::FILE* file = std::fopen(path.string().c_str(), "rb");
+    if (file == nullptr)
+        return false;
+
+    char magic[sizeof(scene_binary_header_t::magic_value)];
+    bool const binary = std::fread(magic, sizeof(magic), 1, file) == 1
+        && std::memcmp(magic, scene_binary_header_t::magic_value, sizeof(magic)) == 0;
+    std::fclose(file);
+    return binary;
+}
+
+// Load a scene file - either binary, or text through its binary cache when
+// that is up to date. On failure 'error' describes the problem.
+inline bool load_scene_file(std::filesystem::path const& path, mapped_scene_t& scene, std::string& error)
+{
+    if (is_scene_binary(path))
+    {
+        if (!scene.map(path.string().c_str(), error))
+        {
+            error = path.string() + ", " + error;
+            return false;
+        }
+        return true;
+    }
+
+    std::error_code ec;
+    auto const source_size = std::filesystem::file_size(path, ec);
+    auto const source_time = std::filesystem::last_write_time(path, ec);
+    if (ec)
+    {
+        error = "cannot read " + path.string();
+        return false;
+    }
+
+    auto const cache_path = scene_cache_path(path);
+    int64_t const time = static_cast<int64_t>(source_time.time_since_epoch().count());
+    if (scene.map(cache_path.string().c_str(), error)
+        && scene.header().source_size == source_size
+        && scene.header().source_time == time)
+    {
+        return true;
+    }
+    scene.close();
+
+    std::vector<char> text;
+    if (!read_file(path, text))
+    {
+        error = "cannot read " + path.string();
+        return false;
+    }
+
+    scene_file_t parsed;
+    scene_parser_t parser{ text.data(), text.size() };
+    if (!parser.parse(parsed))
+    {
+        error = path.string() + ", " + parser.error();
+        return false;
+    }
+
+    size_t size;
+    auto data = create_scene_binary(parsed, source_size, time, size);
+
+    // The cache is only an optimization - failing to write it is not an error.
+    // Another process may have the old cache mapped, so it is replaced by
+    // renaming a new file over it rather than truncated.
+    std::random_device random;
+    auto temp_path = cache_path;
+    temp_path += "." + std::to_string((static_cast<uint64_t>(random()) << 32) | random()) + ".tmp";
+    std::FILE* file = std::fopen(temp_path.string().c_str(), "wb");
+    if (file != nullptr)
+    {
+        bool saved = std::fwrite(data.get(), 1, size, file) == size;
+        saved = std::fclose(file) == 0 && saved;
+        if (saved)
+            std::filesystem::rename(temp_path, cache_path, ec);
+        if (!saved || ec)
+            std::filesystem::remove(temp_path, ec);
+    }
+
+    return scene.attach(std::move(data), size, error);
+}
+
+template<typename T>
+cameraT_t<T> create_camera(camera_record_t const& camera, T aspect_ratio)
+{
+    auto const vec = [](double const* v) { return vec3T_t<T>{ static_cast<T>(v[0]), static_cast<T>(v[1]), static_cast<T>(v[2]) }; };
+    return {
+        vec(camera.lookfrom),
+        vec(camera.lookat),
+        vec(camera.vup),
+        static_cast<T>(camera.vfov),
+        aspect_ratio,
+        static_cast<T>(camera.aperture),
+        static_cast<T>(camera.focus) };
+}
+
+// Create the materials of a scene file in a scene.
+// Returns their handles, indexed like the materials of the file.
+template<typename T>
+std::vector<material_handleT_t<T>> create_materials(mapped_scene_t const& file, sceneT_t<T>& scene)
+{
+    using diffuse = diffuseT<T>;
+
+    std::vector<material_handleT_t<T>> materials;
+    materials.reserve(file.material_count());
+    for (size_t i = 0; i < file.material_count(); ++i)
+    {
+        material_record_t const& material = file.materials()[i];
+        vec3T_t<T> const albedo{ material.values[0], material.values[1], material.values[2] };
+        switch (static_cast<material_kind_t>(material.kind))
+        {
+        case material_kind_t::diffuse_simple:
+            materials.push_back(scene.template add_material<typename diffuse::simple_t>(albedo));
+            break;
+        case material_kind_t::diffuse_lambertian:
+            materials.push_back(scene.template add_material<typename diffuse::lambertian_t>(albedo));
+            break;
+        case material_kind_t::diffuse_hemisphere:
+            materials.push_back(scene.template add_material<typename diffuse::hemisphere_scattering_t>(albedo));
+            break;
+        case material_kind_t::metal:
+            materials.push_back(scene.template add_material<metalT_t<T>>(albedo, static_cast<T>(material.values[3])));
+            break;
+        default:
+            materials.push_back(scene.template add_material<dielectricT_t<T>>(static_cast<T>(material.values[0])));
+            break;
+        }
+    }
+    return materials;
+}
+
+// Create the spheres of a scene file as objects in a scene.
+// Only needed to render them with something other than the scene's own BVH.
+template<typename T>
+void create_spheres(mapped_scene_t const& file, std::vector<material_handleT_t<T>> const& materials, sceneT_t<T>& scene)
+{
+    float const* spheres = file.spheres();
+    for (size_t i = 0; i < file.sphere_count(); ++i)
+    {
+        point3T_t<T> const center{ spheres[4 * i + 0], spheres[4 * i + 1], spheres[4 * i + 2] };
+        scene.add_sphere(center, spheres[4 * i + 3], materials[file.sphere_materials()[i]]);
+    }
+}
+
+// Load the meshes of a scene file into a scene and add them to 'meshes'.
+// Relative mesh paths are taken from 'directory'. Meshes are created as
+// prototypes, not in the scene's world, so they can be traced next to any
+// representation of the spheres. On failure 'error' describes the problem.
+template<typename T>
+bool create_meshes(
+    mapped_scene_t const& file,
+    std::vector<material_handleT_t<T>> const& materials,
+    std::filesystem::path const& directory,
+    sceneT_t<T>& scene,
+    hittableT_list_t<T>& meshes,
+    std::string& error)
+{
+    // Meshes loaded so far by file, with the material they were loaded with
+    std::map<std::string_view, std::pair<hittableT_t<T> const*, material_handleT_t<T>>> loaded;
+    for (size_t i = 0; i < file.mesh_count(); ++i)
+    {
+        mesh_record_t const& record = file.meshes()[i];
+        material_handleT_t<T> const material = materials[record.material];
+        std::string_view const path = file.mesh_path(i);
+        auto [iter, added] = loaded.try_emplace(path);
+        auto& [mesh, mesh_material] = iter->second;
+        if (added)
+        {
+            mesh_dataT_t<T> data;
+            std::filesystem::path const mesh_path = directory / std::filesystem::path{ path };
+            if (!load_obj(mesh_path.string().c_str(), data, error))
+                return false;
+            mesh = scene.template add_prototype<triangle_meshT_t<T>>(std::move(data), material);
+            mesh_material = material;
+        }
+
+        auto const transform = transformT_t<T>::from_matrices(record.transform, record.inverse);
+        if (transform.is_identity() && material == mesh_material)
+            meshes.add(mesh);
+        else
+            meshes.add(scene.template add_prototype<instanceT_t<T>>(mesh, transform, material == mesh_material ? nullptr : material));
+    }
+    return true;
+}
+
+#endif // _SRC_INC_SCENE_FILE_HPP_
@@ -0,0 +1,191 @@
+#ifndef _SRC_INC_SCENES_HPP_
+#define _SRC_INC_SCENES_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include "vec3.hpp"
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "materials.hpp"
+#include "scene.hpp"
+#include "utility.hpp"
+#include "warp.hpp"
+
+template<typename T>
+vec3T_t<T> random_color(rng_t& rng, T min = 0, T max = 1)
+{
+    return { random_value<T>(rng, min, max), random_value<T>(rng, min, max), random_value<T>(rng, min, max) };
+}
+
+// Layout and materials of a field of small random spheres
+struct sphere_field_t final
+{
+    // Spheres per side of the square grid. The grid always covers the
+    // same area so more spheres are also smaller.
+    int32_t grid_size = 22;
+
+    // Materials are chosen by a random value - diffuse below the first
+    // threshold, metal below the second and glass otherwise.
+    double diffuse_below = 0.7;
+    double metal_below = 0.95;
+};
+
+// Add the material of a small sphere, chosen by 'choose_mat' as described in sphere_field_t.
+template<typename T>
+material_handleT_t<T> add_field_material(rng_t& rng, sceneT_t<T>& scene, sphere_field_t const& field, T choose_mat)
+{
+    using diffuse = diffuseT<T>;
+
+    if (choose_mat < field.diffuse_below)
+    {
+        // diffuse
+        auto albedo = random_color<T>(rng) * random_color<T>(rng);
+        return scene.template add_material<typename diffuse::hemisphere_scattering_t>(albedo);
+    }
+    else if (choose_mat < field.metal_below)
+    {
+        // metal
+        auto albedo = random_color<T>(rng, 0.5, 1);
+        auto fuzz = random_value<T>(rng, 0, 0.5);
+        return scene.template add_material<metalT_t<T>>(albedo, fuzz);
+    }
+
+    // glass
+    return scene.template add_material<dielectricT_t<T>>(1.5);
+}
+
+// Three large spheres in the middle of the generated scenes
+template<typename T>
+void add_large_spheres(sceneT_t<T>& scene)
+{
+    using diffuse = diffuseT<T>;
+    using metal_t = metalT_t<T>;
+    using dielectric_t = dielectricT_t<T>;
+
+    auto material1 = scene.template add_material<dielectric_t>(1.5);
+    scene.add_sphere(point3T_t<T>{ 0, 1, 0 }, 1, material1);
+
+    auto material2 = scene.template add_material<typename diffuse::lambertian_t>(vec3T_t<T>{ 0.4, 0.2, 0.1 });
+    scene.add_sphere(point3T_t<T>{ -4, 1, 0 }, 1, material2);
+
+    auto material3 = scene.template add_material<metal_t>(vec3T_t<T>{ 0.7, 0.6, 0.5 }, 0.0);
+    scene.add_sphere(point3T_t<T>{ 4, 1, 0 }, 1, material3);
+}
+
+// Generate a ground, a field of small spheres and three large spheres.
+template<typename T>
+void sphere_field_scene(rng_t& rng, sceneT_t<T>& scene, sphere_field_t const& field)
+{
+    using diffuse = diffuseT<T>;
+
+    auto ground_material = scene.template add_material<typename diffuse::lambertian_t>(vec3T_t<T>{ 0.5, 0.5, 0.5 });
+    scene.add_sphere(point3T_t<T>{ 0, -1000, 0 }, 1000, ground_material);
+
+    // Generate many small spheres
+    double const cell = 22.0 / field.grid_size;
+    T const radius = static_cast<T>(0.2 * cell);
+    int32_t const half = field.grid_size / 2;
+    for (int32_t a = -half; a < field.grid_size - half; a++)
+    {
+        for (int32_t b = -half; b < field.grid_size - half; b++)
+        {
+            auto choose_mat = random_value<T>(rng);
+            point3T_t<T> center((a + 0.9 * random_value<T>(rng)) * cell, radius, (b + 0.9 * random_value<T>(rng)) * cell);
+
+            if ((center - point3T_t<T>{ 4, radius, 0 }).length() > 0.9)
+            {
+                scene.add_sphere(center, radius, add_field_material(rng, scene, field, choose_mat));
+            }
+        }
+    }
+
+    // Three large spheres
+    add_large_spheres(scene);
+}
+
+// Layout of a field of instanced clusters of spheres
+struct instanced_field_t final
+{
+    // Grid and materials as in sphere_field_t - each small sphere becomes a cluster.
+    sphere_field_t field;
+
+    // Distinct clusters - the only geometry stored.
+    int32_t prototype_count = 8;
+
+    int32_t cluster_spheres = 24;
+};
+
+// Generate a ground, a field of clusters of small spheres and three large
+// spheres. Every cluster is an instance of one of a few prototypes, rotated
+// and placed in its grid cell, so the memory used depends on the grid size
+// but not on the number of spheres per cluster.
+template<typename T>
+void instanced_field_scene(rng_t& rng, sceneT_t<T>& scene, instanced_field_t const& instanced)
+{
+    using diffuse = diffuseT<T>;
+    using transform_t = transformT_t<T>;
+
+    sphere_field_t const& field = instanced.field;
+    auto ground_material = scene.template add_material<typename diffuse::lambertian_t>(vec3T_t<T>{ 0.5, 0.5, 0.5 });
+    scene.add_sphere(point3T_t<T>{ 0, -1000, 0 }, 1000, ground_material);
+
+    // Clusters fit in the unit sphere around the origin.
+    std::vector<hittableT_t<T> const*> prototypes;
+    for (int32_t p = 0; p < instanced.prototype_count; ++p)
+    {
+        hittableT_list_t<T> cluster;
+        for (int32_t i = 0; i < instanced.cluster_spheres; ++i)
+        {
+            auto choose_mat = random_value<T>(rng);
+            point3T_t<T> center = T(0.7) * random_in_unit_sphere<T>(rng);
+            T radius = random_value<T>(rng, 0.15, 0.3);
+            cluster.add(scene.template add_prototype<sphereT_t<T>>(center, radius, add_field_material(rng, scene, field, choose_mat)));
+        }
+        prototypes.push_back(scene.template add_prototype<bvhT_t<T>>(cluster));
+    }
+
+    double const cell = 22.0 / field.grid_size;
+    T const scale = static_cast<T>(0.2 * cell);
+    int32_t const half = field.grid_size / 2;
+    for (int32_t a = -half; a < field.grid_size - half; a++)
+    {
+        for (int32_t b = -half; b < field.grid_size - half; b++)
+        {
+            auto const prototype = prototypes[rng.next_u32() % prototypes.size()];
+            T const angle = random_value<T>(rng, 0, 360);
+            point3T_t<T> center((a + 0.9 * random_value<T>(rng)) * cell, scale, (b + 0.9 * random_value<T>(rng)) * cell);
+
+            if ((center - point3T_t<T>{ 4, scale, 0 }).length() > 0.9)
+            {
+                scene.add_instance(prototype,
+                    transform_t::translate(center) * transform_t::rotate({ 0, 1, 0 }, angle) * transform_t::scale(scale));
+            }
+        }
+    }
+
+    // Three large spheres
+    add_large_spheres(scene);
+}
+
+// Generate the scene's spheres and materials
+template<typename T>
+void random_scene(rng_t& rng, sceneT_t<T>& scene)
+{
+    sphere_field_scene(rng, scene, sphere_field_t{});
+}
+
+// Camera looking at the spheres of random_scene(), sphere_field_scene() and instanced_field_scene()
+template<typename T>
+cameraT_t<T> random_scene_camera(T aspect_ratio)
+{
+    point3T_t<T> lookfrom{ 13, 2, 3 };
+    point3T_t<T> lookat{ 0, 0, 0 };
+    vec3T_t<T> vup{ 0, 1, 0 };
+    T dist_to_focus = 10.0;
+    T aperture = 0.1;
+
+    return { lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus };
+}
+
+#endif // _SRC_INC_SCENES_HPP_
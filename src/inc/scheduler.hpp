@@ -0,0 +1,121 @@
+#ifndef _SRC_INC_SCHEDULER_HPP_
+#define _SRC_INC_SCHEDULER_HPP_
+
+#include <cstdint>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Rectangular region of the image - [x0, x1) by [y0, y1)
+// Rows are counted from the top of the image.
+struct tile_t final
+{
+    int32_t index;
+    int32_t x0;
+    int32_t y0;
+    int32_t x1;
+    int32_t y1;
+};
+
+// Splits an image into tiles and renders them on a pool of worker threads.
+// Each worker owns a deque of tiles. A worker pops tiles from the front of its
+// own deque and, once that is empty, steals from the back of another worker's.
+class tile_scheduler_t final
+{
+    // Aligned to avoid false sharing between workers.
+    struct alignas(64) worker_queue_t final
+    {
+        std::mutex lock;
+        std::deque<tile_t> tiles;
+    };
+
+    std::vector<tile_t> _tiles;
+    int32_t _thread_count;
+public:
+    tile_scheduler_t(int32_t width, int32_t height, int32_t tile_size, int32_t thread_count)
+        : _thread_count{ std::max(thread_count, 1) }
+    {
+        int32_t index = 0;
+        for (int32_t y = 0; y < height; y += tile_size)
+        {
+            for (int32_t x = 0; x < width; x += tile_size)
+            {
+                _tiles.push_back({
+                    index++,
+                    x,
+                    y,
+                    std::min(x + tile_size, width),
+                    std::min(y + tile_size, height) });
+            }
+        }
+    }
+
+    std::vector<tile_t> const& tiles() const { return _tiles; }
+    int32_t thread_count() const { return _thread_count; }
+
+    // Call the supplied function for every tile - func(tile_t const&, int32_t thread_id).
+    // Returns once all tiles have been processed.
+    template<typename FUNC>
+    void run(FUNC&& func) const
+    {
+        std::vector<worker_queue_t> queues(_thread_count);
+
+        // Hand out contiguous runs of tiles so each worker starts
+        // with a coherent region of the image.
+        size_t const tile_count = _tiles.size();
+        for (size_t i = 0; i < tile_count; ++i)
+            queues[(i * _thread_count) / tile_count].tiles.push_back(_tiles[i]);
+
+        auto worker = [&](int32_t id)
+        {
+            while (true)
+            {
+                std::optional<tile_t> tile = pop(queues[id]);
+                for (int32_t n = 1; !tile && n < _thread_count; ++n)
+                    tile = steal(queues[(id + n) % _thread_count]);
+
+                // Nothing left to do or steal.
+                if (!tile)
+                    return;
+
+                func(*tile, id);
+            }
+        };
+
+        std::vector<std::jthread> threads;
+        threads.reserve(_thread_count - 1);
+        for (int32_t id = 1; id < _thread_count; ++id)
+            threads.emplace_back(worker, id);
+
+        // The calling thread is worker 0.
+        worker(0);
+    }
+
+private: // static
+    static std::optional<tile_t> pop(worker_queue_t& queue)
+    {
+        std::scoped_lock lock{ queue.lock };
+        if (queue.tiles.empty())
+            return std::nullopt;
+
+        tile_t tile = queue.tiles.front();
+        queue.tiles.pop_front();
+        return tile;
+    }
+
+    static std::optional<tile_t> steal(worker_queue_t& queue)
+    {
+        std::scoped_lock lock{ queue.lock };
+        if (queue.tiles.empty())
+            return std::nullopt;
+
+        tile_t tile = queue.tiles.back();
+        queue.tiles.pop_back();
+        return tile;
+    }
+};
+
+#endif // _SRC_INC_SCHEDULER_HPP_
@@ -1,52 +1,358 @@
 #ifndef _SRC_INC_SHAPES_HPP_
 #define _SRC_INC_SHAPES_HPP_
 
+#include <cstdint>
 #include <cmath>
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
 #include "elements.hpp"
+#include "utility.hpp"
+#include "stats.hpp"
+
+// Find the nearest root of a ray/sphere intersection in [t_min, t_max].
+// Every sphere primitive uses this arithmetic, so they all agree on hits.
+// 'near_side' is set to whether the root is the nearer of the two.
+template<typename T>
+bool sphere_root(point3T_t<T> const& center, T radius, rayT_t<T> const& r, T t_min, T t_max, T& root, bool& near_side)
+{
+    vec3T_t<T> oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius * radius;
+    auto discriminant = half_b * half_b - a * c;
+
+    if (discriminant < 0)
+        return false;
+
+    // Find the nearest root that lies in the acceptable range.
+    auto disc_sqrt = std::sqrt(discriminant);
+    root = (-half_b - disc_sqrt) / a;
+    near_side = true;
+    if (root < t_min || t_max < root)
+    {
+        root = (-half_b + disc_sqrt) / a;
+        near_side = false;
+        if (root < t_min || t_max < root)
+            return false;
+    }
+    return true;
+}
+
+template<typename T>
+bool sphere_root(point3T_t<T> const& center, T radius, rayT_t<T> const& r, T t_min, T t_max, T& root)
+{
+    bool near_side;
+    return sphere_root(center, radius, r, t_min, t_max, root, near_side);
+}
+
+// Recompute the near or far root of a ray/sphere intersection found with
+// cheaper arithmetic, e.g. in a lower precision or with a reciprocal. The
+// root is not chosen again by range - that could switch to the far side of
+// the sphere when the new root moves just outside [t_min, t_max], after
+// other geometry was already culled by the distance of the near one.
+template<typename T>
+T sphere_side_root(point3T_t<T> const& center, T radius, rayT_t<T> const& r, bool near_side)
+{
+    vec3T_t<T> oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius * radius;
+    auto disc_sqrt = std::sqrt(std::max(half_b * half_b - a * c, T(0)));
+    return near_side
+        ? (-half_b - disc_sqrt) / a
+        : (-half_b + disc_sqrt) / a;
+}
+
+// Same arithmetic as sphere_root(), evaluated for all lanes at once.
+// Lanes are searched up to their own 't_max'. Returns the mask of lanes with a root.
+// 'near_mask' is set to the mask of lanes whose root is the nearer of the two.
+template<typename T>
+uint32_t sphere_packet_roots(point3T_t<T> const& center, T radius, ray_packetT_t<T> const& r, T t_min, T const* t_max, T* roots, uint32_t& near_mask)
+{
+    T const rr = radius * radius;
+    alignas(32) int32_t found[packet_width];
+    alignas(32) int32_t near_side[packet_width];
+    for (int32_t lane = 0; lane < packet_width; ++lane)
+    {
+        T const ox = r.origin_x[lane] - center.x();
+        T const oy = r.origin_y[lane] - center.y();
+        T const oz = r.origin_z[lane] - center.z();
+        T const dx = r.dir_x[lane];
+        T const dy = r.dir_y[lane];
+        T const dz = r.dir_z[lane];
+
+        T const a = dx * dx + dy * dy + dz * dz;
+        T const half_b = ox * dx + oy * dy + oz * dz;
+        T const c = (ox * ox + oy * oy + oz * oz) - rr;
+        T const discriminant = half_b * half_b - a * c;
+
+        // Negative discriminants are clamped to keep the lane well defined - they are masked below.
+        T const disc_sqrt = std::sqrt(std::max(discriminant, T(0)));
+        T const near_root = (-half_b - disc_sqrt) / a;
+        T const far_root = (-half_b + disc_sqrt) / a;
+        // Bitwise rather than logical operators keep the loop free of branches.
+        int32_t const near_ok = (near_root >= t_min) & (near_root <= t_max[lane]);
+        int32_t const far_ok = (far_root >= t_min) & (far_root <= t_max[lane]);
+
+        roots[lane] = near_ok ? near_root : far_root;
+        found[lane] = (discriminant >= 0) & (near_ok | far_ok);
+        near_side[lane] = near_ok;
+    }
+
+    uint32_t mask = 0;
+    near_mask = 0;
+    for (int32_t lane = 0; lane < packet_width; ++lane)
+    {
+        mask |= static_cast<uint32_t>(found[lane]) << lane;
+        near_mask |= static_cast<uint32_t>(near_side[lane]) << lane;
+    }
+    return mask;
+}
+
+template<typename T>
+uint32_t sphere_packet_roots(point3T_t<T> const& center, T radius, ray_packetT_t<T> const& r, T t_min, T const* t_max, T* roots)
+{
+    uint32_t near_mask;
+    return sphere_packet_roots(center, radius, r, t_min, t_max, roots, near_mask);
+}
+
+// Fill the hit record of a ray that hit a sphere at 'root'.
+template<typename T>
+void sphere_hit_result(point3T_t<T> const& center, T radius, material_handleT_t<T> material, rayT_t<T> const& r, T root, hit_resultT_t<T>& result)
+{
+    result.t = root;
+    result.p = r.at(result.t);
+    auto outward_normal = (result.p - center) / radius;
+    result.set_face_normal(r, outward_normal);
+    result.material = material;
+}
 
 template<typename T>
 class sphereT_t final : public hittableT_t<T>
 {
     point3T_t<T> _center;
     T _radius;
-    std::shared_ptr<materialT_t<T>> _material;
+    material_handleT_t<T> _material;
 public:
     using hit_result_t = typename hittableT_t<T>::hit_result_t;
+    using ray_packet_t = typename hittableT_t<T>::ray_packet_t;
+    using hit_packet_t = typename hittableT_t<T>::hit_packet_t;
 
     sphereT_t() = default;
-    sphereT_t(point3T_t<T> cen, T r, std::shared_ptr<materialT_t<T>> material)
+    sphereT_t(point3T_t<T> cen, T r, material_handleT_t<T> material)
         : _center{ cen }
         , _radius{ r }
-        , _material{ std::move(material) }
+        , _material{ material }
     { }
     virtual ~sphereT_t() = default;
 
+    point3T_t<T> center() const { return _center; }
+    T radius() const { return _radius; }
+    material_handleT_t<T> material() const { return _material; }
+
     bool hit(rayT_t<T> const& r, T t_min, T t_max, hit_result_t& result) const override
     {
-        vec3T_t<T> oc = r.origin() - _center;
-        auto a = r.direction().length_squared();
-        auto half_b = dot(oc, r.direction());
-        auto c = oc.length_squared() - _radius * _radius;
-        auto discriminant = half_b * half_b - a * c;
+        count_stat(stat_t::sphere_tests);
 
-        if (discriminant < 0)
+        T root;
+        if (!sphere_root(_center, _radius, r, t_min, t_max, root))
             return false;
 
-        // Find the nearest root that lies in the acceptable range.
-        auto disc_sqrt = std::sqrt(discriminant);
-        auto root = (-half_b - disc_sqrt) / a;
-        if (root < t_min || t_max < root)
+        sphere_hit_result(_center, _radius, _material, r, root, result);
+        return true;
+    }
+
+    uint32_t hit_packet(ray_packet_t const& r, T t_min, hit_packet_t& result, uint32_t mask) const override
+    {
+        count_stat(stat_t::sphere_tests, std::popcount(mask));
+
+        alignas(32) T roots[packet_width];
+        uint32_t const hit_mask = sphere_packet_roots(_center, _radius, r, t_min, result.t, roots) & mask;
+
+        // Only lanes that hit pay for the hit record.
+        for (int32_t lane = 0; lane < packet_width; ++lane)
+        {
+            if (hit_mask & (1u << lane))
+            {
+                sphere_hit_result(_center, _radius, _material, r.ray(lane), roots[lane], result.hits[lane]);
+                result.t[lane] = roots[lane];
+            }
+        }
+        return hit_mask;
+    }
+
+    bool bounding_box(aabbT_t<T>& box) const override
+    {
+        vec3T_t<T> extent{ _radius, _radius, _radius };
+        box = { _center - extent, _center + extent };
+        return true;
+    }
+};
+
+// Spheres stored as a structure of arrays.
+// A ray is tested against a block of spheres per iteration - centers and
+// radii are read with vector loads and the closest hit of the block is
+// found with a min-reduction. Unlike a hittableT_list_t of sphereT_t there
+// is no pointer chasing or virtual call per sphere.
+template<typename T>
+class sphere_soaT_t final : public hittableT_t<T>
+{
+public:
+    // Spheres tested per iteration - two vector registers worth of lanes.
+    static constexpr int32_t block_size = 2 * packet_width;
+
+private:
+    template<typename U>
+    using array_t = std::vector<U, aligned_allocatorT_t<U>>;
+
+    array_t<T> _center_x;
+    array_t<T> _center_y;
+    array_t<T> _center_z;
+    array_t<T> _radius;
+    array_t<uint32_t> _material_index;
+    size_t _count = 0;
+
+    std::vector<material_handleT_t<T>> _materials;
+    std::unordered_map<material_handleT_t<T>, uint32_t> _material_lookup;
+public:
+    using hit_result_t = typename hittableT_t<T>::hit_result_t;
+
+    sphere_soaT_t() = default;
+    virtual ~sphere_soaT_t() = default;
+
+    size_t size() const { return _count; }
+
+    // Register a material in the soup's material table - returns its index.
+    uint32_t add_material(material_handleT_t<T> material)
+    {
+        auto iter = _material_lookup.find(material);
+        if (iter != _material_lookup.end())
+            return iter->second;
+
+        auto index = static_cast<uint32_t>(_materials.size());
+        _material_lookup.emplace(material, index);
+        _materials.push_back(material);
+        return index;
+    }
+
+    void add(point3T_t<T> center, T radius, uint32_t material_index)
+    {
+        // Arrays are kept a multiple of the block size so
+        // the kernel never needs a scalar remainder loop.
+        if (_count % block_size == 0)
         {
-            root = (-half_b + disc_sqrt) / a;
-            if (root < t_min || t_max < root)
-                return false;
+            size_t const capacity = _count + block_size;
+            _center_x.resize(capacity, 0);
+            _center_y.resize(capacity, 0);
+            _center_z.resize(capacity, 0);
+            _radius.resize(capacity, 0);
+            _material_index.resize(capacity, 0);
         }
 
-        result.t = root;
-        result.p = r.at(result.t);
-        auto outward_normal = (result.p - _center) / _radius;
-        result.set_face_normal(r, outward_normal);
-        result.material = _material;
+        _center_x[_count] = center.x();
+        _center_y[_count] = center.y();
+        _center_z[_count] = center.z();
+        _radius[_count] = radius;
+        _material_index[_count] = material_index;
+        _count++;
+    }
+
+    void add(point3T_t<T> center, T radius, material_handleT_t<T> material)
+    {
+        add(center, radius, add_material(material));
+    }
+
+    bool hit(rayT_t<T> const& r, T t_min, T t_max, hit_result_t& result) const override
+    {
+        count_stat(stat_t::sphere_tests, _count);
+
+        T const ox = r.origin().x();
+        T const oy = r.origin().y();
+        T const oz = r.origin().z();
+        T const dx = r.direction().x();
+        T const dy = r.direction().y();
+        T const dz = r.direction().z();
+        T const a = r.direction().length_squared();
+        T const inv_a = 1 / a;
+        T const infinity = std::numeric_limits<T>::infinity();
+
+        T closest_so_far = t_max;
+        size_t closest_index = _count;
+        bool closest_near = true; // Whether the closest hit is the near root
+        for (size_t base = 0; base < _count; base += block_size)
+        {
+            // Lanes past the last sphere are padding.
+            auto const valid = static_cast<int32_t>(std::min<size_t>(block_size, _count - base));
+
+            alignas(64) T roots[block_size];
+            int32_t near_won[block_size];
+            for (int32_t lane = 0; lane < block_size; ++lane)
+            {
+                T const cx = ox - _center_x[base + lane];
+                T const cy = oy - _center_y[base + lane];
+                T const cz = oz - _center_z[base + lane];
+                T const radius = _radius[base + lane];
+
+                T const half_b = cx * dx + cy * dy + cz * dz;
+                T const c = (cx * cx + cy * cy + cz * cz) - radius * radius;
+                T const discriminant = half_b * half_b - a * c;
+
+                // Multiply by the reciprocal - the winner's root is recomputed exactly below.
+                T const disc_sqrt = std::sqrt(std::max(discriminant, T(0)));
+                T const near_root = (-half_b - disc_sqrt) * inv_a;
+                T const far_root = (-half_b + disc_sqrt) * inv_a;
+                int32_t const near_ok = (near_root >= t_min) & (near_root <= closest_so_far);
+                int32_t const far_ok = (far_root >= t_min) & (far_root <= closest_so_far);
+                int32_t const found = (discriminant >= 0) & (near_ok | far_ok) & (lane < valid);
+
+                T const root = near_ok ? near_root : far_root;
+                roots[lane] = found ? root : infinity;
+                near_won[lane] = near_ok;
+            }
+
+            // Horizontal min-reduction over the block.
+            T block_min = infinity;
+            for (int32_t lane = 0; lane < block_size; ++lane)
+                block_min = std::min(block_min, roots[lane]);
+
+            if (block_min < infinity)
+            {
+                int32_t lane = 0;
+                while (roots[lane] != block_min)
+                    ++lane;
+                closest_so_far = block_min;
+                closest_index = base + lane;
+                closest_near = near_won[lane] != 0;
+            }
+        }
+
+        if (closest_index == _count)
+            return false;
+
+        // Recompute the winning root of the closest sphere with the same arithmetic as sphereT_t.
+        point3T_t<T> const center{ _center_x[closest_index], _center_y[closest_index], _center_z[closest_index] };
+        T const radius = _radius[closest_index];
+        T const root = sphere_side_root(center, radius, r, closest_near);
+        sphere_hit_result(center, radius, _materials[_material_index[closest_index]], r, root, result);
+        return true;
+    }
+
+    bool bounding_box(aabbT_t<T>& box) const override
+    {
+        if (_count == 0)
+            return false;
+
+        box = {};
+        for (size_t i = 0; i < _count; ++i)
+        {
+            point3T_t<T> center{ _center_x[i], _center_y[i], _center_z[i] };
+            vec3T_t<T> extent{ _radius[i], _radius[i], _radius[i] };
+            box = surrounding_box(box, aabbT_t<T>{ center - extent, center + extent });
+        }
         return true;
     }
 };
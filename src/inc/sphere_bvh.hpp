@@ -0,0 +1,287 @@
+#ifndef _SRC_INC_SPHERE_BVH_HPP_
+#define _SRC_INC_SPHERE_BVH_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "aabb.hpp"
+#include "elements.hpp"
+#include "bvh.hpp"
+#include "scene.hpp"
+#include "shapes.hpp"
+#include "stats.hpp"
+
+// Sphere arrays and BVH nodes in the layout sphere_bvhT_t reads.
+template<typename F>
+struct sphere_bvh_dataT_t final
+{
+    std::vector<F> spheres; // Center and radius of each sphere - 4 values per sphere
+    std::vector<uint32_t> sphere_materials;
+    std::vector<bvh_nodeT_t<F>> nodes;
+
+    // Spheres are reordered when the BVH is built.
+    void add(point3T_t<F> center, F radius, uint32_t material)
+    {
+        spheres.insert(spheres.end(), { center.x(), center.y(), center.z(), radius });
+        sphere_materials.push_back(material);
+    }
+
+    size_t size() const { return sphere_materials.size(); }
+
+    // Build the BVH and store the spheres in its leaf order.
+    void build()
+    {
+        std::vector<aabbT_t<F>> bounds;
+        bounds.reserve(size());
+        for (size_t i = 0; i < size(); ++i)
+        {
+            point3T_t<F> const center{ spheres[4 * i + 0], spheres[4 * i + 1], spheres[4 * i + 2] };
+            vec3T_t<F> const extent{ spheres[4 * i + 3], spheres[4 * i + 3], spheres[4 * i + 3] };
+            bounds.push_back({ center - extent, center + extent });
+        }
+
+        std::vector<uint32_t> order;
+        bvh_builderT_t<F>::build(bounds, nodes, order);
+
+        std::vector<F> ordered_spheres(spheres.size());
+        std::vector<uint32_t> ordered_materials(sphere_materials.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            std::copy_n(&spheres[4 * static_cast<size_t>(order[i])], 4, &ordered_spheres[4 * i]);
+            ordered_materials[i] = sphere_materials[order[i]];
+        }
+        spheres.swap(ordered_spheres);
+        sphere_materials.swap(ordered_materials);
+    }
+};
+
+// Copy the spheres of a scene into 'data' in precision F.
+// Returns the material table the sphere material indices refer to.
+template<typename F, typename T>
+std::vector<material_handleT_t<T>> add_scene_spheres(sceneT_t<T> const& scene, sphere_bvh_dataT_t<F>& data)
+{
+    std::vector<material_handleT_t<T>> materials;
+    std::unordered_map<material_handleT_t<T>, uint32_t> material_indices;
+    for (auto const* sphere : scene.spheres())
+    {
+        auto const [iter, added] = material_indices.try_emplace(sphere->material(), static_cast<uint32_t>(materials.size()));
+        if (added)
+            materials.push_back(sphere->material());
+
+        point3T_t<T> const& c = sphere->center();
+        data.add({ static_cast<F>(c.x()), static_cast<F>(c.y()), static_cast<F>(c.z()) }, static_cast<F>(sphere->radius()), iter->second);
+    }
+    return materials;
+}
+
+// BVH over spheres stored as flat arrays.
+// Unlike bvhT_t, the leaves index the sphere arrays directly - there is no
+// sphere object, pointer or virtual call per primitive. The arrays and nodes
+// are not owned, so they can be used where they lie (e.g. in a mapped scene
+// file - see mapped_scene_t). Spheres must be in the leaf order of the nodes.
+//
+// Spheres and nodes are stored in precision F and hits are reported in T.
+// With a lower F - mixed precision - the BVH is traversed and the spheres
+// intersected in F, then the root of the closest sphere is found again in T,
+// so hit points are as accurate as T allows.
+template<typename T, typename F = T>
+class sphere_bvhT_t final : public hittableT_t<T>
+{
+    static constexpr bool mixed_precision = !std::is_same_v<T, F>;
+
+    F const* _spheres; // Center and radius of each sphere - 4 values per sphere
+    uint32_t const* _sphere_materials; // Index into the material table
+    bvh_nodeT_t<F> const* _nodes;
+    size_t _node_count;
+    std::vector<material_handleT_t<T>> _materials;
+public:
+    using hittable_t = hittableT_t<T>;
+    using hit_result_t = typename hittable_t::hit_result_t;
+    using ray_packet_t = typename hittable_t::ray_packet_t;
+    using hit_packet_t = typename hittable_t::hit_packet_t;
+
+    sphere_bvhT_t(
+        F const* spheres,
+        uint32_t const* sphere_materials,
+        bvh_nodeT_t<F> const* nodes,
+        size_t node_count,
+        std::vector<material_handleT_t<T>> materials)
+        : _spheres{ spheres }
+        , _sphere_materials{ sphere_materials }
+        , _nodes{ nodes }
+        , _node_count{ node_count }
+        , _materials{ std::move(materials) }
+    { }
+
+    sphere_bvhT_t(sphere_bvh_dataT_t<F> const& data, std::vector<material_handleT_t<T>> materials)
+        : sphere_bvhT_t{ data.spheres.data(), data.sphere_materials.data(), data.nodes.data(), data.nodes.size(), std::move(materials) }
+    { }
+
+    virtual ~sphere_bvhT_t() = default;
+
+    bool hit(rayT_t<T> const& r, T t_min, T t_max, hit_result_t& result) const override
+    {
+        if (_node_count == 0)
+            return false;
+
+        rayT_t<F> const traversal_ray = convert_ray(r);
+
+        // The hit record is only filled for the closest sphere.
+        F closest_so_far = static_cast<F>(t_max);
+        int32_t closest_index = -1;
+        bool closest_near = true; // Whether the closest hit is the near root
+        traverse_bvh(_nodes, traversal_ray, static_cast<F>(t_min), closest_so_far,
+            [&](int32_t offset, int32_t count, F& closest)
+            {
+                count_stat(stat_t::sphere_tests, count);
+
+                bool hit_leaf = false;
+                for (int32_t i = offset; i < offset + count; ++i)
+                {
+                    F root;
+                    bool near_side;
+                    if (sphere_root(center<F>(i), radius<F>(i), traversal_ray, static_cast<F>(t_min), closest, root, near_side))
+                    {
+                        hit_leaf = true;
+                        closest = root;
+                        closest_index = i;
+                        closest_near = near_side;
+                    }
+                }
+                return hit_leaf;
+            });
+
+        if (closest_index < 0)
+            return false;
+
+        set_result(r, closest_index, closest_near, static_cast<T>(closest_so_far), result);
+        return true;
+    }
+
+    uint32_t hit_packet(ray_packet_t const& r, T t_min, hit_packet_t& result, uint32_t mask) const override
+    {
+        if (_node_count == 0 || mask == 0)
+            return 0;
+
+        ray_packetT_t<F> converted;
+        ray_packetT_t<F> const& traversal_packet = convert_packet(r, converted);
+        alignas(32) F closest_so_far[packet_width];
+        for (int32_t lane = 0; lane < packet_width; ++lane)
+            closest_so_far[lane] = static_cast<F>(result.t[lane]);
+
+        int32_t closest_index[packet_width];
+        uint32_t closest_near = 0; // Lanes whose closest hit is the near root
+        uint32_t const hit_mask = traverse_bvh_packet(_nodes, traversal_packet, static_cast<F>(t_min), closest_so_far, mask,
+            [&](int32_t offset, int32_t count, uint32_t node_mask)
+            {
+                count_stat(stat_t::sphere_tests, static_cast<uint64_t>(count) * std::popcount(node_mask));
+
+                uint32_t leaf_mask = 0;
+                for (int32_t i = offset; i < offset + count; ++i)
+                {
+                    alignas(32) F roots[packet_width];
+                    uint32_t near_mask;
+                    uint32_t const found = sphere_packet_roots(center<F>(i), radius<F>(i), traversal_packet, static_cast<F>(t_min), closest_so_far, roots, near_mask) & node_mask;
+                    for (int32_t lane = 0; lane < packet_width; ++lane)
+                    {
+                        if (found & (1u << lane))
+                        {
+                            closest_so_far[lane] = roots[lane];
+                            closest_index[lane] = i;
+                        }
+                    }
+                    closest_near = (closest_near & ~found) | (near_mask & found);
+                    leaf_mask |= found;
+                }
+                return leaf_mask;
+            });
+
+        for (int32_t lane = 0; lane < packet_width; ++lane)
+        {
+            if (hit_mask & (1u << lane))
+            {
+                set_result(r.ray(lane), closest_index[lane], (closest_near & (1u << lane)) != 0, static_cast<T>(closest_so_far[lane]), result.hits[lane]);
+                result.t[lane] = result.hits[lane].t;
+            }
+        }
+        return hit_mask;
+    }
+
+    bool bounding_box(aabbT_t<T>& box) const override
+    {
+        if (_node_count == 0)
+            return false;
+
+        bvh_nodeT_t<F> const& root = _nodes[0];
+        box = {
+            { root.bounds_min[0], root.bounds_min[1], root.bounds_min[2] },
+            { root.bounds_max[0], root.bounds_max[1], root.bounds_max[2] } };
+        return true;
+    }
+
+private:
+    template<typename U>
+    point3T_t<U> center(int32_t i) const
+    {
+        F const* sphere = &_spheres[4 * static_cast<size_t>(i)];
+        return { static_cast<U>(sphere[0]), static_cast<U>(sphere[1]), static_cast<U>(sphere[2]) };
+    }
+
+    template<typename U>
+    U radius(int32_t i) const
+    {
+        return static_cast<U>(_spheres[4 * static_cast<size_t>(i) + 3]);
+    }
+
+    static rayT_t<F> convert_ray(rayT_t<T> const& r)
+    {
+        if constexpr (mixed_precision)
+        {
+            vec3T_t<T> const& o = r.origin();
+            vec3T_t<T> const& d = r.direction();
+            return {
+                { static_cast<F>(o.x()), static_cast<F>(o.y()), static_cast<F>(o.z()) },
+                { static_cast<F>(d.x()), static_cast<F>(d.y()), static_cast<F>(d.z()) } };
+        }
+        else
+        {
+            return r;
+        }
+    }
+
+    static ray_packetT_t<F> const& convert_packet(ray_packet_t const& r, ray_packetT_t<F>& converted)
+    {
+        if constexpr (mixed_precision)
+        {
+            for (int32_t lane = 0; lane < packet_width; ++lane)
+                converted.set(lane, convert_ray(r.ray(lane)));
+            return converted;
+        }
+        else
+        {
+            return r;
+        }
+    }
+
+    // Fill the hit record of the closest sphere, found at 'root' during traversal.
+    // 'near_side' is whether the root is the nearer of the sphere's two.
+    void set_result(rayT_t<T> const& r, int32_t i, bool near_side, T root, hit_result_t& result) const
+    {
+        point3T_t<T> const c = center<T>(i);
+        T const rad = radius<T>(i);
+
+        // Find the same root again in T.
+        if constexpr (mixed_precision)
+            root = sphere_side_root(c, rad, r, near_side);
+
+        sphere_hit_result(c, rad, _materials[_sphere_materials[i]], r, root, result);
+    }
+};
+
+#endif // _SRC_INC_SPHERE_BVH_HPP_
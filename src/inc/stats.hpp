@@ -0,0 +1,206 @@
+#ifndef _SRC_INC_STATS_HPP_
+#define _SRC_INC_STATS_HPP_
+
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+#include "elements.hpp"
+
+// Render statistics - counters incremented on the hot paths.
+// Build with ART_STATS to enable them. Otherwise every counting
+// function is empty and the calls compile away.
+#ifdef ART_STATS
+inline constexpr bool stats_enabled = true;
+#else
+inline constexpr bool stats_enabled = false;
+#endif // ART_STATS
+
+enum class stat_t
+{
+    camera_rays, // Rays created by the camera
+    path_segments, // Closest-hit queries against the world
+    bvh_nodes, // BVH nodes visited
+    sphere_tests, // Ray/sphere intersection tests
+    triangle_tests, // Ray/triangle intersection tests
+    paths_escaped, // Paths that left the scene
+    paths_absorbed, // Paths ended by a material
+    paths_bounce_limit, // Paths cut off at the bounce limit
+    paths_roulette, // Paths ended by Russian roulette
+    count
+};
+
+struct render_stats_t final
+{
+    // Path lengths of this many bounces or more share the last bucket.
+    static constexpr int32_t path_length_buckets = 65;
+
+    uint64_t counters[static_cast<size_t>(stat_t::count)] = {};
+    uint64_t scatters[static_cast<size_t>(material_kind_t::count)] = {};
+    uint64_t path_lengths[path_length_buckets] = {};
+
+    void merge(render_stats_t const& other)
+    {
+        for (size_t i = 0; i < std::size(counters); ++i)
+            counters[i] += other.counters[i];
+        for (size_t i = 0; i < std::size(scatters); ++i)
+            scatters[i] += other.scatters[i];
+        for (size_t i = 0; i < std::size(path_lengths); ++i)
+            path_lengths[i] += other.path_lengths[i];
+    }
+};
+
+// Each thread counts into its own block, so counting needs no atomics.
+// Blocks are merged into the totals when their thread exits.
+class stats_registry_t final
+{
+    std::mutex _lock;
+    std::vector<render_stats_t const*> _live;
+    render_stats_t _retired;
+
+    class thread_block_t final
+    {
+    public:
+        render_stats_t stats;
+
+        thread_block_t()
+        {
+            instance().attach(&stats);
+        }
+
+        ~thread_block_t()
+        {
+            instance().detach(&stats);
+        }
+    };
+public:
+    static stats_registry_t& instance()
+    {
+        static stats_registry_t registry;
+        return registry;
+    }
+
+    // The calling thread's counters
+    static render_stats_t& local()
+    {
+        thread_local thread_block_t block;
+        return block.stats;
+    }
+
+    // Totals of all threads. Counters of running threads may be incomplete.
+    render_stats_t collect()
+    {
+        std::scoped_lock lock{ _lock };
+        render_stats_t total = _retired;
+        for (auto const* stats : _live)
+            total.merge(*stats);
+        return total;
+    }
+
+private:
+    void attach(render_stats_t const* stats)
+    {
+        std::scoped_lock lock{ _lock };
+        _live.push_back(stats);
+    }
+
+    void detach(render_stats_t const* stats)
+    {
+        std::scoped_lock lock{ _lock };
+        _retired.merge(*stats);
+        _live.erase(std::find(_live.begin(), _live.end(), stats));
+    }
+};
+
+inline void count_stat(stat_t stat, uint64_t n = 1)
+{
+    if constexpr (stats_enabled)
+        stats_registry_t::local().counters[static_cast<size_t>(stat)] += n;
+}
+
+inline void count_scatter(material_kind_t kind, uint64_t n = 1)
+{
+    if constexpr (stats_enabled)
+        stats_registry_t::local().scatters[static_cast<size_t>(kind)] += n;
+}
+
+// Record the end of a path after 'bounces' bounces.
+inline void count_path(stat_t reason, int32_t bounces)
+{
+    if constexpr (stats_enabled)
+    {
+        render_stats_t& stats = stats_registry_t::local();
+        ++stats.counters[static_cast<size_t>(reason)];
+        ++stats.path_lengths[std::min(bounces, render_stats_t::path_length_buckets - 1)];
+    }
+}
+
+// Print the totals of all threads. Does nothing if statistics are disabled.
+inline void print_stats(std::FILE* file)
+{
+    if constexpr (!stats_enabled)
+        return;
+
+    static char const* const stat_names[] = {
+        "camera rays",
+        "path segments",
+        "BVH nodes visited",
+        "sphere tests",
+        "triangle tests",
+        "paths escaped",
+        "paths absorbed",
+        "paths at bounce limit",
+        "paths ended by roulette",
+    };
+    static_assert(std::size(stat_names) == static_cast<size_t>(stat_t::count));
+
+    static char const* const kind_names[] = {
+        "diffuse (simple)",
+        "diffuse (lambertian)",
+        "diffuse (hemisphere)",
+        "metal",
+        "dielectric",
+    };
+    static_assert(std::size(kind_names) == static_cast<size_t>(material_kind_t::count));
+
+    render_stats_t const stats = stats_registry_t::instance().collect();
+    auto const counter = [&](stat_t stat) { return stats.counters[static_cast<size_t>(stat)]; };
+
+    std::fprintf(file, "Statistics\n");
+    for (size_t i = 0; i < std::size(stat_names); ++i)
+        std::fprintf(file, "  %-24s %14llu\n", stat_names[i], static_cast<unsigned long long>(stats.counters[i]));
+
+    uint64_t const segments = std::max<uint64_t>(counter(stat_t::path_segments), 1);
+    std::fprintf(file, "  %-24s %14.2f\n", "BVH nodes per segment", double(counter(stat_t::bvh_nodes)) / segments);
+    std::fprintf(file, "  %-24s %14.2f\n", "sphere tests per segment", double(counter(stat_t::sphere_tests)) / segments);
+    std::fprintf(file, "  %-24s %14.2f\n", "triangle tests per segment", double(counter(stat_t::triangle_tests)) / segments);
+
+    std::fprintf(file, "Scatters\n");
+    for (size_t i = 0; i < std::size(kind_names); ++i)
+        std::fprintf(file, "  %-24s %14llu\n", kind_names[i], static_cast<unsigned long long>(stats.scatters[i]));
+
+    uint64_t paths = 0;
+    uint64_t bounces = 0;
+    for (int32_t i = 0; i < render_stats_t::path_length_buckets; ++i)
+    {
+        paths += stats.path_lengths[i];
+        bounces += stats.path_lengths[i] * i;
+    }
+
+    std::fprintf(file, "Path length (bounces) - mean %.3f\n", double(bounces) / std::max<uint64_t>(paths, 1));
+    for (int32_t i = 0; i < render_stats_t::path_length_buckets; ++i)
+    {
+        if (stats.path_lengths[i] == 0)
+            continue;
+        std::fprintf(file, "  %3d%s %14llu (%5.1f%%)\n",
+            i,
+            i == render_stats_t::path_length_buckets - 1 ? "+" : " ",
+            static_cast<unsigned long long>(stats.path_lengths[i]),
+            100.0 * stats.path_lengths[i] / paths);
+    }
+}
+
+#endif // _SRC_INC_STATS_HPP_
@@ -1,8 +1,10 @@
 #ifndef _SRC_INC_UTILITY_HPP_
 #define _SRC_INC_UTILITY_HPP_
 
+#include <cstddef>
+#include <cstdint>
+#include <new>
 #include <numbers>
-#include <random>
 #include <concepts>
 
 template<typename T>
@@ -12,22 +14,140 @@ T degrees_to_radians(T degrees)
     return degrees * std::numbers::pi_v<T> / 180;
 }
 
+// Source of the leading draws of a sample's random stream - see sampler.hpp.
+// A sequence spreads the values of a draw evenly over a pixel's samples,
+// where independent random values clump.
+class sample_sequence_t
+{
+public:
+    virtual ~sample_sequence_t() = default;
+
+    // 32-bit fraction for draw 'draw' of bounce 'bounce' of sample 'index'
+    // of pixel 'pixel'. Returns false if the sequence does not cover the draw.
+    virtual bool sample(uint64_t pixel, uint32_t index, uint32_t bounce, uint32_t draw, uint32_t& value) const = 0;
+};
+
+// Counter-based random number generator.
+// A stream is identified by a key (e.g. seed, pixel and sample) and every draw
+// hashes the key with a counter. There is no shared state, so the values drawn
+// for a stream do not depend on which thread consumes it or in what order.
+class rng_t final
+{
+    uint64_t _key;
+    uint64_t _counter;
+    sample_sequence_t const* _sequence = nullptr;
+    uint64_t _pixel = 0;
+    uint32_t _index = 0;
+public:
+    rng_t(uint64_t seed, uint64_t stream = 0, uint64_t substream = 0)
+        : _key{ mix(mix(mix(seed) ^ stream) ^ substream) }
+        , _counter{ 0 }
+    { }
+
+    // Stream of sample 'index' of 'pixel'. Draws covered by 'sequence' are
+    // taken from it - a null sequence leaves the stream as above.
+    rng_t(sample_sequence_t const* sequence, uint64_t seed, uint64_t pixel, uint32_t index)
+        : rng_t{ seed, pixel, index }
+    {
+        _sequence = sequence;
+        _pixel = pixel;
+        _index = index;
+    }
+
+    // Restart the stream at the start of a bounce's sub-sequence.
+    // The counter's upper half is the bounce index so each bounce
+    // draws its own values regardless of how many were used before it.
+    void set_bounce(uint32_t bounce)
+    {
+        _counter = static_cast<uint64_t>(bounce) << 32;
+    }
+
+    uint64_t next_u64()
+    {
+        uint64_t const counter = _counter++;
+
+        // SplitMix64 evaluated at the counter position.
+        uint64_t value = mix(_key + (counter * 0x9e3779b97f4a7c15));
+
+        // A sequence value takes the upper half. The lower half stays
+        // random and jitters double precision draws within it.
+        uint32_t sampled;
+        if (_sequence != nullptr && _sequence->sample(_pixel, _index, static_cast<uint32_t>(counter >> 32), static_cast<uint32_t>(counter), sampled))
+            value = (static_cast<uint64_t>(sampled) << 32) | (value & 0xffffffff);
+        return value;
+    }
+
+    uint32_t next_u32()
+    {
+        return static_cast<uint32_t>(next_u64() >> 32);
+    }
+
+private: // static
+    static uint64_t mix(uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+};
+
 // Get a random value from [0, 1)
 template<typename T>
     requires std::floating_point<T>
-T random_value()
+T random_value(rng_t& rng)
 {
-    static std::uniform_real_distribution<T> distribution{ 0, 1 };
-    static std::mt19937 generator;
-    return distribution(generator);
+    if constexpr (sizeof(T) <= sizeof(uint32_t))
+    {
+        // Use the upper 24 bits - the float mantissa.
+        return static_cast<T>(rng.next_u32() >> 8) * T(0x1p-24);
+    }
+    else
+    {
+        // Use the upper 53 bits - the double mantissa.
+        return static_cast<T>(rng.next_u64() >> 11) * T(0x1p-53);
+    }
 }
 
 // Get a random value from [min, max)
 template<typename T>
     requires std::floating_point<T>
-T random_value(T min, T max)
+T random_value(rng_t& rng, T min, T max)
 {
-    return min + (max - min) * random_value<T>();
+    return min + (max - min) * random_value<T>(rng);
 }
 
+// Allocator for contiguous arrays read with vector loads.
+// Memory is aligned to ALIGN bytes - at least a full vector register.
+template<typename T, size_t ALIGN = 64>
+class aligned_allocatorT_t
+{
+public:
+    using value_type = T;
+
+    template<typename U>
+    struct rebind
+    {
+        using other = aligned_allocatorT_t<U, ALIGN>;
+    };
+
+    aligned_allocatorT_t() = default;
+
+    template<typename U>
+    aligned_allocatorT_t(aligned_allocatorT_t<U, ALIGN> const&)
+    { }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{ ALIGN }));
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        ::operator delete(p, std::align_val_t{ ALIGN });
+    }
+
+    template<typename U>
+    bool operator==(aligned_allocatorT_t<U, ALIGN> const&) const { return true; }
+};
+
 #endif // _SRC_INC_UTILITY_HPP_
\ No newline at end of file
@@ -2,6 +2,14 @@
 #define _SRC_INC_VEC3_HPP_
 
 #include <cmath>
+#include <algorithm>
+
+// vec3T_t<float> is kept in an SSE register, with an unused fourth lane,
+// unless ART_SCALAR_VEC3 is defined or the target lacks SSE2.
+#if !defined(ART_SCALAR_VEC3) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define ART_VEC3_SSE 1
+#include <emmintrin.h>
+#endif // ART_VEC3_SSE
 
 template<typename T>
 class vec3T_t final
@@ -123,4 +131,146 @@ vec3T_t<T> unit_vector(vec3T_t<T> v)
     return v / v.length();
 }
 
+// Component-wise minimum, as std::min per component
+template<typename T>
+vec3T_t<T> component_min(vec3T_t<T> const &u, vec3T_t<T> const &v)
+{
+    return { std::min(u.x(), v.x()), std::min(u.y(), v.y()), std::min(u.z(), v.z()) };
+}
+
+// Component-wise maximum, as std::max per component
+template<typename T>
+vec3T_t<T> component_max(vec3T_t<T> const &u, vec3T_t<T> const &v)
+{
+    return { std::max(u.x(), v.x()), std::max(u.y(), v.y()), std::max(u.z(), v.z()) };
+}
+
+#ifdef ART_VEC3_SSE
+// Single precision vector in an SSE register.
+// Every operation rounds exactly as the generic version does - lanes are
+// computed independently and dot() adds in the same order - so renders
+// are identical with either layout. The fourth lane is ignored.
+template<>
+class vec3T_t<float> final
+{
+    __m128 _v;
+public:
+    using elem_t = float;
+
+    vec3T_t() : _v{ _mm_setzero_ps() }
+    { }
+    vec3T_t(float x, float y, float z) : _v{ _mm_set_ps(0, z, y, x) }
+    { }
+    explicit vec3T_t(__m128 v) : _v{ v }
+    { }
+
+    __m128 simd() const { return _v; }
+
+    float x() const { return _mm_cvtss_f32(_v); }
+    float y() const { return _mm_cvtss_f32(_mm_shuffle_ps(_v, _v, _MM_SHUFFLE(1, 1, 1, 1))); }
+    float z() const { return _mm_cvtss_f32(_mm_movehl_ps(_v, _v)); }
+
+    vec3T_t operator-() const { return vec3T_t{ _mm_xor_ps(_v, _mm_set1_ps(-0.0f)) }; }
+
+    vec3T_t& operator+=(vec3T_t const &v)
+    {
+        _v = _mm_add_ps(_v, v._v);
+        return *this;
+    }
+
+    vec3T_t& operator*=(float const t)
+    {
+        _v = _mm_mul_ps(_v, _mm_set1_ps(t));
+        return *this;
+    }
+
+    vec3T_t& operator/=(float const t)
+    {
+        return *this *= 1/t;
+    }
+
+    float length() const
+    {
+        return _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(length_squared())));
+    }
+
+    float length_squared() const;
+
+    bool near_zero() const
+    {
+        // Return true if the vector is close to zero in all dimensions.
+        __m128 const magnitude = _mm_andnot_ps(_mm_set1_ps(-0.0f), _v);
+        return (_mm_movemask_ps(_mm_cmplt_ps(magnitude, _mm_set1_ps(1e-8f))) & 0x7) == 0x7;
+    }
+};
+
+inline vec3T_t<float> operator+(vec3T_t<float> const &u, vec3T_t<float> const &v)
+{
+    return vec3T_t<float>{ _mm_add_ps(u.simd(), v.simd()) };
+}
+
+inline vec3T_t<float> operator-(vec3T_t<float> const &u, vec3T_t<float> const &v)
+{
+    return vec3T_t<float>{ _mm_sub_ps(u.simd(), v.simd()) };
+}
+
+inline vec3T_t<float> operator*(vec3T_t<float> const &u, vec3T_t<float> const &v)
+{
+    return vec3T_t<float>{ _mm_mul_ps(u.simd(), v.simd()) };
+}
+
+inline vec3T_t<float> operator*(float t, vec3T_t<float> const &v)
+{
+    return vec3T_t<float>{ _mm_mul_ps(_mm_set1_ps(t), v.simd()) };
+}
+
+inline vec3T_t<float> operator*(vec3T_t<float> const &v, float t)
+{
+    return t * v;
+}
+
+inline vec3T_t<float> operator/(vec3T_t<float> v, float t)
+{
+    return (1 / t) * v;
+}
+
+inline float dot(vec3T_t<float> const &u, vec3T_t<float> const &v)
+{
+    // (x + y) + z, as in the generic version
+    __m128 const p = _mm_mul_ps(u.simd(), v.simd());
+    __m128 const xy = _mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(_mm_add_ss(xy, _mm_movehl_ps(p, p)));
+}
+
+inline vec3T_t<float> cross(vec3T_t<float> const &u, vec3T_t<float> const &v)
+{
+    __m128 const u_yzx = _mm_shuffle_ps(u.simd(), u.simd(), _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 const u_zxy = _mm_shuffle_ps(u.simd(), u.simd(), _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 const v_yzx = _mm_shuffle_ps(v.simd(), v.simd(), _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 const v_zxy = _mm_shuffle_ps(v.simd(), v.simd(), _MM_SHUFFLE(3, 1, 0, 2));
+    return vec3T_t<float>{ _mm_sub_ps(_mm_mul_ps(u_yzx, v_zxy), _mm_mul_ps(u_zxy, v_yzx)) };
+}
+
+inline vec3T_t<float> unit_vector(vec3T_t<float> v)
+{
+    return v / v.length();
+}
+
+// Operands are swapped so ties, e.g. -0 and +0, pick the same value as std::min.
+inline vec3T_t<float> component_min(vec3T_t<float> const &u, vec3T_t<float> const &v)
+{
+    return vec3T_t<float>{ _mm_min_ps(v.simd(), u.simd()) };
+}
+
+inline vec3T_t<float> component_max(vec3T_t<float> const &u, vec3T_t<float> const &v)
+{
+    return vec3T_t<float>{ _mm_max_ps(v.simd(), u.simd()) };
+}
+
+inline float vec3T_t<float>::length_squared() const
+{
+    return dot(*this, *this);
+}
+#endif // ART_VEC3_SSE
+
 #endif // _SRC_INC_VEC3_HPP_
@@ -0,0 +1,106 @@
+#ifndef _SRC_INC_WARP_HPP_
+#define _SRC_INC_WARP_HPP_
+
+#include <cmath>
+#include <algorithm>
+#include <concepts>
+#include <numbers>
+
+#include "vec3.hpp"
+#include "utility.hpp"
+
+// Closed-form maps from uniform random values to points on shapes.
+// Unlike rejection sampling, each map takes a fixed number of draws and has
+// no data-dependent loop, so a draw always feeds the same dimension of a
+// sample (see sampler.hpp) and neighbouring rays take the same path through
+// the code. The maps are continuous, so evenly spread draws stay evenly
+// spread on the shape.
+
+// Uniform point in the unit disk in the xy plane - 2 draws.
+// Concentric mapping of the square [-1, 1]^2 to the disk - see
+// Shirley and Chiu, "A Low Distortion Map Between Disk and Square" (1997).
+template<typename T>
+    requires std::floating_point<T>
+vec3T_t<T> random_in_unit_disk(rng_t& rng)
+{
+    T const a = random_value<T>(rng, -1, 1);
+    T const b = random_value<T>(rng, -1, 1);
+    if (a == 0 && b == 0)
+        return { 0, 0, 0 };
+
+    // Squares of radius r map to circles of radius r.
+    constexpr T quarter_pi = std::numbers::pi_v<T> / 4;
+    T r;
+    T phi;
+    if (std::abs(a) > std::abs(b))
+    {
+        r = a;
+        phi = quarter_pi * (b / a);
+    }
+    else
+    {
+        r = b;
+        phi = 2 * quarter_pi - quarter_pi * (a / b);
+    }
+    return { r * std::cos(phi), r * std::sin(phi), 0 };
+}
+
+// Uniform point on the unit sphere - 2 draws.
+// The height is uniform in [-1, 1] by Archimedes' hat-box theorem.
+template<typename T>
+    requires std::floating_point<T>
+vec3T_t<T> random_unit_vector(rng_t& rng)
+{
+    T const z = 1 - 2 * random_value<T>(rng);
+    T const phi = 2 * std::numbers::pi_v<T> * random_value<T>(rng);
+    T const r = std::sqrt(std::max(T(0), 1 - z * z));
+    return { r * std::cos(phi), r * std::sin(phi), z };
+}
+
+// Uniform point in the unit ball - 3 draws.
+// The volume within radius r grows as r^3, so the radius is a cube root.
+template<typename T>
+    requires std::floating_point<T>
+vec3T_t<T> random_in_unit_sphere(rng_t& rng)
+{
+    vec3T_t<T> const direction = random_unit_vector<T>(rng);
+    return std::cbrt(random_value<T>(rng)) * direction;
+}
+
+// Uniform direction in the hemisphere around 'normal' - 2 draws.
+template<typename T>
+    requires std::floating_point<T>
+vec3T_t<T> random_in_hemisphere(vec3T_t<T> const& normal, rng_t& rng)
+{
+    vec3T_t<T> const direction = random_unit_vector<T>(rng);
+    return (dot(direction, normal) > 0) // In the same hemisphere as the normal
+        ? direction
+        : -direction;
+}
+
+// Unit direction around the unit vector 'normal' with density proportional
+// to the cosine of its angle to the normal - 2 draws. Sampled in spherical
+// coordinates: sin^2(theta) is uniform in [0, 1).
+template<typename T>
+    requires std::floating_point<T>
+vec3T_t<T> random_cosine_direction(vec3T_t<T> const& normal, rng_t& rng)
+{
+    T const sin2_theta = random_value<T>(rng);
+    T const phi = 2 * std::numbers::pi_v<T> * random_value<T>(rng);
+    T const sin_theta = std::sqrt(sin2_theta);
+    T const cos_theta = std::sqrt(1 - sin2_theta);
+
+    // Orthonormal basis around the normal without a branch on its direction - see
+    // Duff et al., "Building an Orthonormal Basis, Revisited" (2017).
+    T const sign = std::copysign(T(1), normal.z());
+    T const a = -1 / (sign + normal.z());
+    T const b = normal.x() * normal.y() * a;
+    vec3T_t<T> const tangent{ 1 + sign * normal.x() * normal.x() * a, sign * b, -sign * normal.x() };
+    vec3T_t<T> const bitangent{ b, sign + normal.y() * normal.y() * a, -normal.y() };
+
+    return (sin_theta * std::cos(phi)) * tangent
+        + (sin_theta * std::sin(phi)) * bitangent
+        + cos_theta * normal;
+}
+
+#endif // _SRC_INC_WARP_HPP_
@@ -1,229 +1,983 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
 #include <cassert>
 #include <cmath>
+#include <charconv>
+#include <system_error>
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <map>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <string>
+#include <filesystem>
+#include <thread>
+
+#ifdef BUILD_WINDOWS
+#include <io.h>
+#include <fcntl.h>
+#endif // BUILD_WINDOWS
 
 #include <vec3.hpp>
 #include <ray.hpp>
 #include <camera.hpp>
 #include <elements.hpp>
+#include <bvh.hpp>
+#include <packet.hpp>
 #include <materials.hpp>
 #include <shapes.hpp>
+#include <scene.hpp>
+#include <scenes.hpp>
+#include <sampler.hpp>
+#include <scene_file.hpp>
+#include <sphere_bvh.hpp>
+#include <scheduler.hpp>
+#include <integrator.hpp>
+#include <image.hpp>
+#include <accumulation.hpp>
+#include <denoise.hpp>
+#include <stats.hpp>
 #include <utility.hpp>
 
 namespace
 {
-    // Type aliases
-    using elem_t = float;
-    using vec3_t = vec3T_t<elem_t>;
-    using point3_t = point3T_t<vec3_t::elem_t>;
-    using color_t = vec3_t;
-    using ray_t = rayT_t<vec3_t::elem_t>;
-    using camera_t = cameraT_t<elem_t>;
-    using sphere_t = sphereT_t<vec3_t::elem_t>;
-    using hittable_list_t = hittableT_list_t<vec3_t::elem_t>;
-    using material_t = materialT_t<vec3_t::elem_t>;
-    using metal_t = metalT_t<vec3_t::elem_t>;
-    using diffuse = diffuseT<vec3_t::elem_t>;
-    using dielectric_t = dielectricT_t<vec3_t::elem_t>;
-
-    struct pixel_t final
+    // Samples per pass of adaptive sampling unless set with --pass.
+    // Every pixel takes at least one pass before its error is estimated.
+    uint32_t const g_adaptive_pass_samples = 8;
+
+    // Pixels within this distance of an unconverged pixel keep sampling.
+    int32_t const g_adaptive_radius = 1;
+
+    // Average the samples of a pixel.
+    template<typename T>
+    vec3T_t<T> resolve_pixel(vec3T_t<T> pixel_color, uint32_t samples)
+    {
+        // Divide the color by the number of samples.
+        auto scale = T(1) / samples;
+        return pixel_color * scale;
+    }
+
+    // Print how many pixels took each number of samples.
+    template<typename T>
+    void report_sample_counts(accumulation_bufferT_t<T>& accumulation)
+    {
+        std::map<uint32_t, uint64_t> pixel_counts;
+        uint64_t total_samples = 0;
+        for (int32_t y = 0; y < accumulation.height(); ++y)
+        {
+            for (int32_t x = 0; x < accumulation.width(); ++x)
+            {
+                uint32_t const samples = accumulation.pixel(x, y).samples;
+                ++pixel_counts[samples];
+                total_samples += samples;
+            }
+        }
+
+        double const pixel_total = static_cast<double>(accumulation.width()) * accumulation.height();
+        std::fprintf(stderr, "Samples per pixel: mean %.2f\n", total_samples / pixel_total);
+        for (auto const& [samples, pixels] : pixel_counts)
+            std::fprintf(stderr, "  %6u spp: %10llu pixels (%5.1f%%)\n", samples, static_cast<unsigned long long>(pixels), 100 * pixels / pixel_total);
+    }
+
+    // How the world is stored and traversed
+    enum class accel_t
+    {
+        bvh, // Bounding volume hierarchy over a list of spheres
+        soa, // Sphere soup - structure of arrays
+        list, // Linear list of spheres
+    };
+
+    // Precision of rendering
+    enum class precision_t
     {
-        uint8_t r;
-        uint8_t g;
-        uint8_t b;
+        single, // float throughout
+        dual, // double throughout
+        mixed, // Traversal and intersection in float, hit points and accumulation in double
     };
 
-    color_t const g_black{ 0, 0, 0 }; // RGB:  0,  0,  0
-    color_t const g_red{ 255, 0, 0 }; // RGB:255,  0,  0
-    color_t const g_white{ 1, 1, 1 }; // RGB:255,255,255
-    color_t const g_gradient_start = g_white;
-    color_t const g_gradient_end{ 0.5, 0.7, 1 }; // Light blue
+    // Camera settings given on the command line.
+    // They override the camera of the scene file.
+    struct camera_options_t final
+    {
+        std::optional<vec3T_t<double>> lookfrom;
+        std::optional<vec3T_t<double>> lookat;
+        std::optional<vec3T_t<double>> vup;
+        std::optional<double> vfov;
+        std::optional<double> aperture;
+        std::optional<double> focus;
+
+        void apply(camera_record_t& camera) const
+        {
+            auto const set = [](double* v, std::optional<vec3T_t<double>> const& value)
+            {
+                if (value)
+                {
+                    v[0] = value->x();
+                    v[1] = value->y();
+                    v[2] = value->z();
+                }
+            };
+            set(camera.lookfrom, lookfrom);
+            set(camera.lookat, lookat);
+            set(camera.vup, vup);
+            camera.vfov = vfov.value_or(camera.vfov);
+            camera.aperture = aperture.value_or(camera.aperture);
+            camera.focus = focus.value_or(camera.focus);
+        }
+    };
+
+    struct options_t final
+    {
+        char const* scene_path = nullptr; // Default is random_scene()
+        char const* save_scene_path = nullptr;
+        uint32_t instanced_grid = 0; // Clusters per side of the instanced scene - 0 is off
+        int32_t image_width = 1200;
+        double aspect_ratio = 3.0 / 2.0;
+        camera_options_t camera;
+        int32_t thread_count = static_cast<int32_t>(std::max(std::thread::hardware_concurrency(), 1u));
+        uint64_t seed = 0;
+        accel_t accel = accel_t::bvh;
+        bool wavefront = false;
+        image_format_t format = image_format_t::ppm;
+        bool stream = false;
+        char const* output_path = nullptr; // Default is stdout
+        uint32_t samples_per_pixel = 10; // Antialiasing sampling rate
+        sampler_kind_t sampler = sampler_kind_t::random;
+        sample_padding_t padding = sample_padding_t::white;
+        uint32_t pass_samples = 0; // Samples added per pass - 0 is all in one pass
+        char const* checkpoint_path = nullptr;
+        double adaptive_threshold = 0; // Error at which a pixel stops sampling - 0 is off
+        bool denoise = false;
+        precision_t precision = precision_t::single;
+        path_settingsT_t<double> path; // Converted to the precision of rendering
+    };
 
-    color_t random_color(elem_t min = 0, elem_t max = 1)
+    void print_usage(char const* app)
     {
-        return { random_value<elem_t>(min, max), random_value<elem_t>(min, max), random_value<elem_t>(min, max) };
+        std::fprintf(stderr,
+            "Usage: %s [--scene FILE [--save-scene FILE] | --instanced N] [--width N] [--aspect A]\n"
+            "          [--lookfrom X,Y,Z] [--lookat X,Y,Z] [--vup X,Y,Z] [--vfov D] [--aperture A] [--focus F]\n"
+            "          [--threads N] [--seed S] [--accel bvh|soa|list] [--integrator path|wavefront]\n"
+            "          [--precision float|double|mixed]\n"
+            "          [--format ppm|p3|pfm] [--stream] [--output FILE]\n"
+            "          [--spp N] [--sampler random|stratified|halton|sobol] [--padding white|blue]\n"
+            "          [--pass N] [--checkpoint FILE] [--adaptive E] [--denoise]\n"
+            "          [--max-bounce N] [--roulette-depth N] [--roulette-clamp P]\n"
+            "  --scene FILE    Scene file to render, text or binary (default: random spheres)\n"
+            "  --save-scene F  Save the scene as a binary scene file and exit\n"
+            "  --instanced N   Render N by N clusters of spheres, instanced from a few shared\n"
+            "                  clusters, instead of the random spheres\n"
+            "  --width N       Image width in pixels (default: 1200)\n"
+            "  --aspect A      Image aspect ratio, width over height (default: 1.5)\n"
+            "  --lookfrom, --lookat, --vup, --vfov, --aperture, --focus\n"
+            "                  Camera placement - overrides the scene file\n"
+            "  --threads N     Number of render threads (default: hardware concurrency)\n"
+            "  --seed S        Seed for scene generation and sampling (default: 0)\n"
+            "  --accel A       World representation (default: bvh)\n"
+            "  --integrator I  Trace paths one at a time or as a wavefront (default: path)\n"
+            "  --precision P   float, double, or mixed - float intersection with double\n"
+            "                  hit points and accumulation (default: float)\n"
+            "  --format F      Binary PPM, text PPM or linear float PFM (default: ppm)\n"
+            "  --stream        Write rows while the rest of the image renders\n"
+            "  --output FILE   File to write the image to (default: stdout)\n"
+            "  --spp N         Samples per pixel (default: 10)\n"
+            "  --sampler S     Sample pattern of pixel, lens and bounce draws (default: random)\n"
+            "  --padding P     Draws not covered by the sampler - white or blue noise (default: white)\n"
+            "  --pass N        Render progressively, adding N samples per pixel per pass\n"
+            "  --checkpoint F  Save the samples to F after every pass and resume from it\n"
+            "  --adaptive E    Stop sampling pixels once their estimated error is below E\n"
+            "                  (e.g. 0.005) - --spp is then the maximum\n"
+            "  --denoise       Filter the noise out of the image, guided by the first surface\n"
+            "                  of each sample\n"
+            "  --max-bounce N      Bounces before a path is cut off (default: 50)\n"
+            "  --roulette-depth N  Bounces before Russian roulette may end a path (default: 3)\n"
+            "  --roulette-clamp P  Highest survival probability in Russian roulette (default: 0.95)\n", app);
     }
 
-    pixel_t create_pixel(color_t pixel_color, int32_t samples)
+    // Parse a positive 32-bit count
+    bool parse_count(char const* value, uint32_t& count)
     {
-        // Divide the color by the number of samples.
-        auto scale = elem_t(1) / samples;
-
-        // Gamma-correct for gamma=2.0 (that is, raise color to power 1/gamma)
-        auto r = std::sqrt(pixel_color.x() * scale);
-        auto g = std::sqrt(pixel_color.y() * scale);
-        auto b = std::sqrt(pixel_color.z() * scale);
-
-        // Write the translated [0,255] value of each color component.
-        auto min = elem_t(0);
-        auto max = elem_t(.999);
-        auto ir = static_cast<uint8_t>(256 * std::clamp(r, min, max));
-        auto ig = static_cast<uint8_t>(256 * std::clamp(g, min, max));
-        auto ib = static_cast<uint8_t>(256 * std::clamp(b, min, max));
-        return { ir, ig, ib };
+        char* end = nullptr;
+        unsigned long parsed = std::strtoul(value, &end, 10);
+        if (*end != '\0' || parsed < 1 || parsed > std::numeric_limits<uint32_t>::max())
+            return false;
+        count = static_cast<uint32_t>(parsed);
+        return true;
     }
 
-    color_t ray_color(ray_t r, hittable_list_t const& world, int32_t max_ray_bounce = 50)
+    // Parse a number
+    bool parse_number(char const* value, double& number)
     {
-        // Accumlation factor for ray bounce.
-        auto acc_factor = color_t{1, 1, 1};
+        char* end = nullptr;
+        number = std::strtod(value, &end);
+        return end != value && *end == '\0' && std::isfinite(number);
+    }
 
-        // Instead of recursion, iterate.
-        for (int32_t i = 0; i < max_ray_bounce; ++i)
+    // Parse a vector written as "x,y,z"
+    bool parse_vector(char const* value, std::optional<vec3T_t<double>>& vector)
+    {
+        double e[3];
+        char* end = nullptr;
+        for (int32_t i = 0; i < 3; ++i)
         {
-            hittable_list_t::hit_result_t hit;
+            e[i] = std::strtod(value, &end);
+            if (end == value || *end != (i < 2 ? ',' : '\0') || !std::isfinite(e[i]))
+                return false;
+            value = end + 1;
+        }
+        vector = { e[0], e[1], e[2] };
+        return true;
+    }
 
-            // Check if an object was hit.
-            // Use 0.001 to address "shadow acne".
-            if (world.hit(r, 0.001, std::numeric_limits<elem_t>::infinity(), hit))
-            {
-                material_t::scatter_result_t scatter;
-                if (!hit.material->scatter(r, hit, scatter))
-                    return g_black;
+    bool parse_number(char const* value, std::optional<double>& number)
+    {
+        double parsed;
+        if (!parse_number(value, parsed))
+            return false;
+        number = parsed;
+        return true;
+    }
 
-                r = scatter.scattered;
-                acc_factor = acc_factor * scatter.attenuation;
-                continue;
+    bool parse_options(int argc, char* argv[], options_t& options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            char const* arg = argv[i];
+            char const* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+            char* end = nullptr;
+            if (std::strcmp(arg, "--scene") == 0 && value != nullptr)
+            {
+                options.scene_path = value;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--save-scene") == 0 && value != nullptr)
+            {
+                options.save_scene_path = value;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--instanced") == 0 && value != nullptr)
+            {
+                if (!parse_count(value, options.instanced_grid) || options.instanced_grid > 65536)
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--width") == 0 && value != nullptr)
+            {
+                uint32_t width;
+                if (!parse_count(value, width) || width < 2 || width > 65536)
+                    return false;
+                options.image_width = static_cast<int32_t>(width);
+                ++i;
+            }
+            else if (std::strcmp(arg, "--aspect") == 0 && value != nullptr)
+            {
+                if (!parse_number(value, options.aspect_ratio) || !(options.aspect_ratio > 0))
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--lookfrom") == 0 && value != nullptr)
+            {
+                if (!parse_vector(value, options.camera.lookfrom))
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--lookat") == 0 && value != nullptr)
+            {
+                if (!parse_vector(value, options.camera.lookat))
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--vup") == 0 && value != nullptr)
+            {
+                if (!parse_vector(value, options.camera.vup))
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--vfov") == 0 && value != nullptr)
+            {
+                if (!parse_number(value, options.camera.vfov) || !(*options.camera.vfov > 0 && *options.camera.vfov < 180))
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--aperture") == 0 && value != nullptr)
+            {
+                if (!parse_number(value, options.camera.aperture) || *options.camera.aperture < 0)
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--focus") == 0 && value != nullptr)
+            {
+                if (!parse_number(value, options.camera.focus) || !(*options.camera.focus > 0))
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--threads") == 0 && value != nullptr)
+            {
+                long count = std::strtol(value, &end, 10);
+                if (*end != '\0' || count < 1)
+                    return false;
+                options.thread_count = static_cast<int32_t>(count);
+                ++i;
+            }
+            else if (std::strcmp(arg, "--seed") == 0 && value != nullptr)
+            {
+                // Unlike strtoull, from_chars rejects a sign and values out of range.
+                char const* value_end = value + std::strlen(value);
+                auto [seed_end, ec] = std::from_chars(value, value_end, options.seed);
+                if (ec != std::errc{} || seed_end != value_end)
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--accel") == 0 && value != nullptr)
+            {
+                if (std::strcmp(value, "bvh") == 0)
+                    options.accel = accel_t::bvh;
+                else if (std::strcmp(value, "soa") == 0)
+                    options.accel = accel_t::soa;
+                else if (std::strcmp(value, "list") == 0)
+                    options.accel = accel_t::list;
+                else
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--precision") == 0 && value != nullptr)
+            {
+                if (std::strcmp(value, "float") == 0)
+                    options.precision = precision_t::single;
+                else if (std::strcmp(value, "double") == 0)
+                    options.precision = precision_t::dual;
+                else if (std::strcmp(value, "mixed") == 0)
+                    options.precision = precision_t::mixed;
+                else
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--integrator") == 0 && value != nullptr)
+            {
+                if (std::strcmp(value, "path") == 0)
+                    options.wavefront = false;
+                else if (std::strcmp(value, "wavefront") == 0)
+                    options.wavefront = true;
+                else
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--sampler") == 0 && value != nullptr)
+            {
+                if (std::strcmp(value, "random") == 0)
+                    options.sampler = sampler_kind_t::random;
+                else if (std::strcmp(value, "stratified") == 0)
+                    options.sampler = sampler_kind_t::stratified;
+                else if (std::strcmp(value, "halton") == 0)
+                    options.sampler = sampler_kind_t::halton;
+                else if (std::strcmp(value, "sobol") == 0)
+                    options.sampler = sampler_kind_t::sobol;
+                else
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--padding") == 0 && value != nullptr)
+            {
+                if (std::strcmp(value, "white") == 0)
+                    options.padding = sample_padding_t::white;
+                else if (std::strcmp(value, "blue") == 0)
+                    options.padding = sample_padding_t::blue;
+                else
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--format") == 0 && value != nullptr)
+            {
+                if (std::strcmp(value, "ppm") == 0)
+                    options.format = image_format_t::ppm;
+                else if (std::strcmp(value, "p3") == 0)
+                    options.format = image_format_t::ppm_ascii;
+                else if (std::strcmp(value, "pfm") == 0)
+                    options.format = image_format_t::pfm;
+                else
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--stream") == 0)
+            {
+                options.stream = true;
+            }
+            else if (std::strcmp(arg, "--spp") == 0 && value != nullptr)
+            {
+                if (!parse_count(value, options.samples_per_pixel))
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--pass") == 0 && value != nullptr)
+            {
+                if (!parse_count(value, options.pass_samples))
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--adaptive") == 0 && value != nullptr)
+            {
+                options.adaptive_threshold = std::strtod(value, &end);
+                if (*end != '\0' || !(options.adaptive_threshold > 0))
+                    return false;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--denoise") == 0)
+            {
+                options.denoise = true;
+            }
+            else if (std::strcmp(arg, "--max-bounce") == 0 && value != nullptr)
+            {
+                uint32_t count;
+                if (!parse_count(value, count) || count > static_cast<uint32_t>(std::numeric_limits<int32_t>::max()))
+                    return false;
+                options.path.max_bounce = static_cast<int32_t>(count);
+                ++i;
+            }
+            else if (std::strcmp(arg, "--roulette-depth") == 0 && value != nullptr)
+            {
+                long depth = std::strtol(value, &end, 10);
+                if (*end != '\0' || depth < 0 || depth > std::numeric_limits<int32_t>::max())
+                    return false;
+                options.path.roulette_min_depth = static_cast<int32_t>(depth);
+                ++i;
+            }
+            else if (std::strcmp(arg, "--roulette-clamp") == 0 && value != nullptr)
+            {
+                double survival = std::strtod(value, &end);
+                if (*end != '\0' || !(survival > 0 && survival <= 1))
+                    return false;
+                options.path.roulette_max_survival = survival;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--checkpoint") == 0 && value != nullptr)
+            {
+                options.checkpoint_path = value;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--output") == 0 && value != nullptr)
+            {
+                options.output_path = value;
+                ++i;
+            }
+            else
+            {
+                return false;
             }
-
-            // No objects hit, produce a gradient background.
-            vec3_t unit_direction = unit_vector(r.direction());
-
-            // The color is gradient along the Y-axis.
-            auto t = elem_t(0.5) * (unit_direction.y() + 1);
-            return acc_factor * ((1 - t) * g_gradient_start + t * g_gradient_end);
         }
 
-        // If we've exceeded the ray bounce limit, no more light is gathered.
-        return g_black;
+        // Only scene files can be saved, and mixed precision traverses a BVH.
+        // Instances need the general world representations.
+        return (options.save_scene_path == nullptr || options.scene_path != nullptr)
+            && (options.precision != precision_t::mixed || options.accel == accel_t::bvh)
+            && (options.instanced_grid == 0 || (options.scene_path == nullptr && options.accel != accel_t::soa && options.precision != precision_t::mixed));
     }
+}
 
-    hittable_list_t random_scene()
+namespace
+{
+    // Render the image in precision T and write it out.
+    template<typename T>
+    int render(options_t const& options)
     {
-        hittable_list_t world;
+        using vec3_t = vec3T_t<T>;
+        using color_t = vec3_t;
+        using ray_t = rayT_t<T>;
+        using camera_t = cameraT_t<T>;
+        using hittable_t = hittableT_t<T>;
+        using bvh_t = bvhT_t<T>;
+        using sphere_bvh_t = sphere_bvhT_t<T, float>;
+        using sphere_soa_t = sphere_soaT_t<T>;
+        using ray_packet_t = ray_packetT_t<T>;
+        using hit_packet_t = hit_packetT_t<T>;
+        using scene_t = sceneT_t<T>;
+        using wavefront_integrator_t = wavefront_integratorT_t<T>;
+        using image_output_t = image_outputT_t<T>;
+        using accumulation_buffer_t = accumulation_bufferT_t<T>;
+        using accumulated_pixel_t = typename accumulation_buffer_t::pixel_t;
+        using feature_buffer_t = feature_bufferT_t<T>;
+        using surface_features_t = surface_featuresT_t<T>;
+        using path_settings_t = path_settingsT_t<T>;
+
+        bool const mixed = options.precision == precision_t::mixed;
+
+        path_settings_t path;
+        path.max_bounce = options.path.max_bounce;
+        path.roulette_min_depth = options.path.roulette_min_depth;
+        path.roulette_max_survival = static_cast<T>(options.path.roulette_max_survival);
+
+        // Hits are found in float in mixed precision - keep float's distance.
+        path.t_min = mixed ? hit_t_min<float> : hit_t_min<T>;
+
+        //
+        // Image
+        //
+        T const aspect_ratio = static_cast<T>(options.aspect_ratio);
+        int32_t const image_width = options.image_width;
+        int32_t const image_height = std::max(static_cast<int32_t>(image_width / aspect_ratio), 2);
+
+        //
+        // World
+        //
+        // Owns all primitives and materials - must outlive the world.
+        scene_t scene;
+        // Spheres of a scene file are rendered from where the file is mapped.
+        mapped_scene_t scene_file;
+        // Spheres of the random scene for a mixed precision BVH
+        sphere_bvh_dataT_t<float> sphere_data;
+        std::unique_ptr<hittable_t> accel;
+        // Meshes of a scene file, traced next to the spheres
+        hittableT_list_t<T> meshes;
+        camera_record_t camera_settings;
+        if (options.scene_path != nullptr)
+        {
+            std::string error;
+            if (!load_scene_file(options.scene_path, scene_file, error))
+            {
+                std::fprintf(stderr, "Failed to load scene: %s\n", error.c_str());
+                return EXIT_FAILURE;
+            }
 
-        auto ground_material = std::make_shared<diffuse::lambertian_t>(color_t{ 0.5, 0.5, 0.5 });
-        world.add(std::make_shared<sphere_t>(point3_t{ 0, -1000, 0 }, 1000, ground_material));
+            std::filesystem::path const directory = std::filesystem::path{ options.scene_path }.parent_path();
+            if (options.save_scene_path != nullptr)
+            {
+                if (!scene_file.save(options.save_scene_path, directory))
+                {
+                    std::fprintf(stderr, "Failed to save scene '%s'\n", options.save_scene_path);
+                    return EXIT_FAILURE;
+                }
+                return EXIT_SUCCESS;
+            }
+
+            // The file is in float - double precision needs its own copy of the spheres.
+            auto materials = create_materials(scene_file, scene);
+            if (options.accel == accel_t::bvh && scene_file.node_count() != 0 && (std::is_same_v<T, float> || mixed))
+            {
+                // The file's BVH - no object is created per sphere.
+                accel = std::make_unique<sphere_bvh_t>(
+                    scene_file.spheres(),
+                    scene_file.sphere_materials(),
+                    scene_file.nodes(),
+                    scene_file.node_count(),
+                    materials);
+            }
+            else
+            {
+                create_spheres(scene_file, materials, scene);
+            }
+
+            if (!create_meshes(scene_file, materials, directory, scene, meshes, error))
+            {
+                std::fprintf(stderr, "Failed to load scene: %s\n", error.c_str());
+                return EXIT_FAILURE;
+            }
+            camera_settings = scene_file.camera();
+        }
+        else
+        {
+            // The scene has its own stream, distinct from any pixel's.
+            rng_t scene_rng{ options.seed, std::numeric_limits<uint64_t>::max() };
+            if (options.instanced_grid != 0)
+            {
+                instanced_field_t instanced;
+                instanced.field.grid_size = static_cast<int32_t>(options.instanced_grid);
+                instanced_field_scene(scene_rng, scene, instanced);
+            }
+            else
+            {
+                random_scene(scene_rng, scene);
+            }
 
-        // Generate many small spheres
-        for (int32_t a = -11; a < 11; a++)
+            if (mixed)
+            {
+                auto materials = add_scene_spheres(scene, sphere_data);
+                sphere_data.build();
+                accel = std::make_unique<sphere_bvh_t>(sphere_data, std::move(materials));
+            }
+        }
+
+        if (!accel)
         {
-            for (int32_t b = -11; b < 11; b++)
+            switch (options.accel)
+            {
+            case accel_t::soa:
             {
-                auto choose_mat = random_value<elem_t>();
-                point3_t center(a + 0.9 * random_value<elem_t>(), 0.2, b + 0.9 * random_value<elem_t>());
+                auto soa = std::make_unique<sphere_soa_t>();
+                for (auto const* sphere : scene.spheres())
+                    soa->add(sphere->center(), sphere->radius(), sphere->material());
+                accel = std::move(soa);
+                break;
+            }
+            case accel_t::list:
+                break;
+            default:
+                // Acceleration structure over the scene
+                accel = std::make_unique<bvh_t>(scene.world());
+                break;
+            }
+        }
+        hittable_t const& spheres = accel ? *accel : static_cast<hittable_t const&>(scene.world());
 
-                if ((center - point3_t{ 4, 0.2, 0 }).length() > 0.9)
+        // Meshes and the spheres under a BVH of their own
+        std::unique_ptr<hittable_t> top_level;
+        if (!meshes.objects().empty())
+        {
+            meshes.add(&spheres);
+            top_level = std::make_unique<bvh_t>(meshes);
+        }
+        hittable_t const& world = top_level ? *top_level : spheres;
+
+        //
+        // Camera
+        //
+        options.camera.apply(camera_settings);
+        if (!is_valid_camera(camera_settings))
+        {
+            std::fprintf(stderr, "Invalid camera - lookfrom and lookat must differ\n");
+            return EXIT_FAILURE;
+        }
+        camera_t camera = create_camera(camera_settings, aspect_ratio);
+
+        //
+        // Render
+        //
+        int32_t const tile_size = 32;
+        tile_scheduler_t scheduler{ image_width, image_height, tile_size, options.thread_count };
+
+        auto pixel_index = [&](int32_t i, int32_t y)
+        {
+            return static_cast<uint64_t>(y) * image_width + i;
+        };
+
+        // Every sample has its own random stream keyed by pixel and sample
+        // index, so the image is identical for any number of threads. The
+        // sampler, if any, supplies the stream's leading draws.
+        std::unique_ptr<sampler_t> const sampler = create_sampler(options.sampler, options.padding, options.seed, image_width, options.samples_per_pixel);
+        auto sample_rng = [&](int32_t i, int32_t y, uint32_t s)
+        {
+            return rng_t{ sampler.get(), options.seed, pixel_index(i, y), s };
+        };
+
+        // Create a camera ray for a pixel sample.
+        auto camera_ray = [&](int32_t i, int32_t y, rng_t& rng)
+        {
+            // Image rows are written from the top, viewport rows count from the bottom.
+            int32_t const j = image_height - 1 - y;
+
+            // Using sampling, apply antialiasing to compute the pixel color.
+            auto u = (i + random_value<T>(rng)) / (image_width - 1);
+            auto v = (j + random_value<T>(rng)) / (image_height - 1);
+
+            // Create a ray from the camera to a point on the viewport.
+            return camera.get_ray(u, v, rng);
+        };
+
+        //
+        // Accumulation
+        //
+        accumulation_settings_t accumulation_settings;
+        accumulation_settings.roulette_max_survival = options.path.roulette_max_survival;
+        accumulation_settings.max_bounce = options.path.max_bounce;
+        accumulation_settings.roulette_min_depth = options.path.roulette_min_depth;
+        accumulation_settings.precision = static_cast<uint32_t>(options.precision);
+        accumulation_buffer_t accumulation{ image_width, image_height, options.seed, sampler_signature(options.sampler, options.padding, options.samples_per_pixel), accumulation_settings };
+        if (options.checkpoint_path != nullptr && !accumulation.map_checkpoint(options.checkpoint_path))
+        {
+            std::fprintf(stderr, "Failed to open checkpoint '%s' - it may be from a different render\n", options.checkpoint_path);
+            return EXIT_FAILURE;
+        }
+
+        // The denoiser's guides are not in the checkpoint, so every pixel
+        // must take samples in this run. One that already has them all cannot.
+        if (options.denoise && accumulation.max_samples() >= options.samples_per_pixel)
+        {
+            std::fprintf(stderr, "--denoise needs this run to add samples to every pixel - raise --spp or resume without --denoise\n");
+            return EXIT_FAILURE;
+        }
+
+        //
+        // Output
+        //
+        std::FILE* file = stdout;
+        if (options.output_path != nullptr)
+        {
+            file = std::fopen(options.output_path, "wb");
+            if (file == nullptr)
+            {
+                std::fprintf(stderr, "Failed to open '%s'\n", options.output_path);
+                return EXIT_FAILURE;
+            }
+        }
+    #ifdef BUILD_WINDOWS
+        else
+        {
+            // Binary formats must not have line endings translated.
+            _setmode(_fileno(stdout), _O_BINARY);
+        }
+    #endif // BUILD_WINDOWS
+
+        image_output_t output{
+            create_image_writer<T>(options.format, file),
+            image_width,
+            image_height,
+            options.stream };
+
+        // First surfaces of the samples, to guide denoising
+        std::unique_ptr<feature_buffer_t> features;
+        if (options.denoise)
+            features = std::make_unique<feature_buffer_t>(image_width, image_height);
+
+        uint32_t const pass_samples = options.pass_samples != 0
+            ? options.pass_samples
+            : (options.adaptive_threshold > 0 ? std::min(options.samples_per_pixel, g_adaptive_pass_samples) : options.samples_per_pixel);
+
+        // Number of samples a pixel should have at the end of a pass.
+        // With adaptive sampling, converged pixels stop taking samples - once
+        // they have taken one in this run if it is to be denoised.
+        std::vector<uint8_t> converged;
+        auto pixel_target = [&](int32_t i, int32_t y, accumulated_pixel_t const& accumulated, uint32_t target)
+        {
+            if (!converged.empty() && converged[pixel_index(i, y)])
+                return (features && features->pixel(i, y).samples == 0) ? accumulated.samples + 1 : accumulated.samples;
+            return std::max(accumulated.samples, target);
+        };
+
+        // Neighbouring pixels along a row are traced together as a packet of
+        // coherent primary rays. Lanes past the end of the tile are masked off.
+        // Each pixel continues from the samples it already has up to its target.
+        auto render_tile_packets = [&](tile_t const& tile, uint32_t target)
+        {
+            for (int32_t y = tile.y0; y < tile.y1; ++y)
+            {
+                for (int32_t x = tile.x0; x < tile.x1; x += packet_width)
                 {
-                    std::shared_ptr<material_t> sphere_material;
-                    if (choose_mat < 0.7)
+                    int32_t const lanes = std::min(packet_width, tile.x1 - x);
+
+                    accumulated_pixel_t pixels[packet_width]{};
+                    uint32_t first_sample[packet_width]{};
+                    uint32_t last_sample[packet_width]{};
+                    uint32_t start = target;
+                    uint32_t end = 0;
+                    for (int32_t lane = 0; lane < lanes; ++lane)
                     {
-                        // diffuse
-                        auto albedo = random_color() * random_color();
-                        auto sphere_material = std::make_shared<diffuse::hemisphere_scattering_t>(albedo);
-                        world.add(std::make_shared<sphere_t>(center, 0.2, sphere_material));
+                        pixels[lane] = accumulation.pixel(x + lane, y);
+                        first_sample[lane] = pixels[lane].samples;
+                        last_sample[lane] = pixel_target(x + lane, y, pixels[lane], target);
+                        start = std::min(start, first_sample[lane]);
+                        end = std::max(end, last_sample[lane]);
                     }
-                    else if (choose_mat < 0.95)
+
+                    for (uint32_t s = start; s < end; ++s)
                     {
-                        // metal
-                        auto albedo = random_color(0.5, 1);
-                        auto fuzz = random_value<elem_t>(0, 0.5);
-                        sphere_material = std::make_shared<metal_t>(albedo, fuzz);
-                        world.add(std::make_shared<sphere_t>(center, 0.2, sphere_material));
+                        // Lanes of pixels that already have this sample, or need no more, are masked off.
+                        uint32_t mask = 0;
+                        for (int32_t lane = 0; lane < lanes; ++lane)
+                            mask |= (first_sample[lane] <= s && s < last_sample[lane]) ? (1u << lane) : 0;
+
+                        ray_packet_t packet;
+                        hit_packet_t hits;
+                        for (int32_t lane = 0; lane < packet_width; ++lane)
+                        {
+                            int32_t const i = x + std::min(lane, lanes - 1);
+                            rng_t rng = sample_rng(i, y, s);
+                            packet.set(lane, camera_ray(i, y, rng));
+                            hits.t[lane] = std::numeric_limits<T>::infinity();
+                        }
+
+                        uint32_t const hit_mask = world.hit_packet(packet, path.t_min, hits, mask);
+                        for (int32_t lane = 0; lane < lanes; ++lane)
+                        {
+                            if ((mask & (1u << lane)) == 0)
+                                continue;
+
+                            // Bounces draw from their own sub-sequences, so
+                            // the sample's stream can be recreated for shading.
+                            rng_t rng = sample_rng(x + lane, y, s);
+                            auto const* first_hit = (hit_mask & (1u << lane)) ? &hits.hits[lane] : nullptr;
+
+                            // Given the ray compute the color of the pixel the ray intersects.
+                            surface_features_t surface;
+                            pixels[lane].add(ray_color(packet.ray(lane), first_hit, world, rng, path, features ? &surface : nullptr));
+                            if (features)
+                                features->pixel(x + lane, y).add(surface);
+                        }
                     }
-                    else
+
+                    for (int32_t lane = 0; lane < lanes; ++lane)
+                        accumulation.pixel(x + lane, y) = pixels[lane];
+                }
+            }
+        };
+
+        // All samples of the tile are traced together as one wavefront.
+        // Each thread reuses its integrator's queues across tiles.
+        std::vector<wavefront_integrator_t> integrators(scheduler.thread_count(), wavefront_integrator_t{ world, path });
+        std::vector<std::vector<color_t>> sample_colors(scheduler.thread_count());
+        std::vector<std::vector<surface_features_t>> sample_surfaces(scheduler.thread_count());
+        std::vector<std::vector<uint32_t>> sample_targets(scheduler.thread_count());
+        auto render_tile_wavefront = [&](tile_t const& tile, int32_t thread_id, uint32_t target)
+        {
+            wavefront_integrator_t& integrator = integrators[thread_id];
+            std::vector<color_t>& colors = sample_colors[thread_id];
+            std::vector<surface_features_t>& surfaces = sample_surfaces[thread_id];
+            std::vector<uint32_t>& targets = sample_targets[thread_id];
+
+            int32_t const tile_width = tile.x1 - tile.x0;
+            auto local_index = [&](int32_t i, int32_t y)
+            {
+                return static_cast<uint32_t>((y - tile.y0) * tile_width + (i - tile.x0));
+            };
+
+            targets.resize(tile_width * (tile.y1 - tile.y0));
+            uint32_t start = target;
+            uint32_t end = 0;
+            for (int32_t y = tile.y0; y < tile.y1; ++y)
+            {
+                for (int32_t i = tile.x0; i < tile.x1; ++i)
+                {
+                    accumulated_pixel_t const& accumulated = accumulation.pixel(i, y);
+                    targets[local_index(i, y)] = pixel_target(i, y, accumulated, target);
+                    start = std::min(start, accumulated.samples);
+                    end = std::max(end, targets[local_index(i, y)]);
+                }
+            }
+            if (start >= end)
+                return;
+
+            uint32_t const span = end - start;
+            auto sample_slot = [&](int32_t i, int32_t y, uint32_t s)
+            {
+                return local_index(i, y) * span + (s - start);
+            };
+
+            colors.resize(targets.size() * span);
+            for (int32_t y = tile.y0; y < tile.y1; ++y)
+            {
+                for (int32_t i = tile.x0; i < tile.x1; ++i)
+                {
+                    for (uint32_t s = accumulation.pixel(i, y).samples; s < targets[local_index(i, y)]; ++s)
                     {
-                        // glass
-                        sphere_material = std::make_shared<dielectric_t>(1.5);
-                        world.add(std::make_shared<sphere_t>(center, 0.2, sphere_material));
+                        rng_t rng = sample_rng(i, y, s);
+                        ray_t r = camera_ray(i, y, rng);
+                        integrator.add(r, rng, sample_slot(i, y, s));
                     }
                 }
             }
-        }
 
-        // Three large spheres
-        auto material1 = std::make_shared<dielectric_t>(1.5);
-        world.add(std::make_shared<sphere_t>(point3_t{ 0, 1, 0 }, 1, material1));
+            if (features)
+                surfaces.resize(colors.size());
+            integrator.trace(colors.data(), features ? surfaces.data() : nullptr);
 
-        auto material2 = std::make_shared<diffuse::lambertian_t>(color_t{ 0.4, 0.2, 0.1 });
-        world.add(std::make_shared<sphere_t>(point3_t{ -4, 1, 0 }, 1, material2));
-
-        auto material3 = std::make_shared<metal_t>(color_t{ 0.7, 0.6, 0.5 }, 0.0);
-        world.add(std::make_shared<sphere_t>(point3_t{ 4, 1, 0 }, 1, material3));
+            // Add samples in order so the pixels match the path integrator.
+            for (int32_t y = tile.y0; y < tile.y1; ++y)
+            {
+                for (int32_t i = tile.x0; i < tile.x1; ++i)
+                {
+                    accumulated_pixel_t& accumulated = accumulation.pixel(i, y);
+                    uint32_t const pixel_end = targets[local_index(i, y)];
+                    for (uint32_t s = accumulated.samples; s < pixel_end; ++s)
+                    {
+                        if (features)
+                            features->pixel(i, y).add(surfaces[sample_slot(i, y, s)]);
+                        accumulated.add(colors[sample_slot(i, y, s)]);
+                    }
+                }
+            }
+        };
 
-        return world;
-    }
-}
+        // Passes add samples until every pixel has the requested number.
+        // A resumed render starts from the pass its least sampled pixel is in.
+        uint32_t const resumed_samples = accumulation.min_samples();
+        uint32_t target = std::min(options.samples_per_pixel, (resumed_samples / pass_samples + 1) * pass_samples);
+        bool const report_passes = options.checkpoint_path != nullptr || pass_samples < options.samples_per_pixel;
+        if (report_passes && resumed_samples != 0)
+            std::fprintf(stderr, "Resuming at %u spp\n", resumed_samples);
 
-int main()
-{
-    //
-    // Image
-    //
-    elem_t const aspect_ratio = 3.0 / 2.0;
-    int32_t const image_width = 1200;
-    int32_t const image_height = static_cast<int32_t>(image_width / aspect_ratio);
-    int32_t const samples_per_pixel = 10; // Antialiasing sampling rate
-
-    //
-    // World
-    //
-    hittable_list_t world = random_scene();
-
-    //
-    // Camera
-    //
-    point3_t lookfrom{ 13, 2, 3 };
-    point3_t lookat{ 0, 0, 0 };
-    vec3_t vup{ 0, 1, 0 };
-    elem_t dist_to_focus = 10.0;
-    elem_t aperture = 0.1;
-
-    camera_t camera{ lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus };
-
-    //
-    // Render
-    //
-    std::vector<pixel_t> image_data;
-    image_data.reserve(image_width * image_height);
-    for (int32_t j = image_height - 1; j >= 0; --j)
-    {
-        for (int32_t i = 0; i < image_width; ++i)
+        while (true)
         {
-            // Using sampling, apply antialiasing to compute the pixel color.
-            color_t pixel_color{};
-            for (int s = 0; s < samples_per_pixel; ++s)
+            bool const final_pass = target == options.samples_per_pixel;
+            if (options.adaptive_threshold > 0)
+                find_converged<T>(accumulation, static_cast<T>(options.adaptive_threshold), pass_samples, g_adaptive_radius, converged);
+
+            scheduler.run([&](tile_t const& tile, int32_t thread_id)
             {
-                auto u = (i + random_value<elem_t>()) / (image_width - 1);
-                auto v = (j + random_value<elem_t>()) / (image_height - 1);
+                if (options.wavefront)
+                    render_tile_wavefront(tile, thread_id, target);
+                else
+                    render_tile_packets(tile, target);
 
-                // Create a ray from the camera to a point on the viewport.
-                ray_t r = camera.get_ray(u, v);
+                // The image is produced by the last pass, unless it is denoised.
+                if (final_pass && !features)
+                {
+                    for (int32_t y = tile.y0; y < tile.y1; ++y)
+                    {
+                        for (int32_t i = tile.x0; i < tile.x1; ++i)
+                        {
+                            accumulated_pixel_t const& accumulated = accumulation.pixel(i, y);
+                            output.pixel(i, y) = resolve_pixel(accumulated.color_sum(), accumulated.samples);
+                        }
+                    }
+                    output.complete(tile.x0, tile.y0, tile.x1, tile.y1);
+                }
+            });
+
+            if (!accumulation.checkpoint())
+                std::fprintf(stderr, "Failed to write checkpoint\n");
+            if (report_passes)
+                std::fprintf(stderr, "Pass complete: %u spp\n", target);
 
-                // Given the ray compute the color of the pixel the ray intersects.
-                pixel_color += ray_color(r, world);
+            if (final_pass)
+                break;
+            target = std::min(options.samples_per_pixel, target + pass_samples);
+        }
+
+        // The filter takes neighbouring pixels, so it waits for the whole image.
+        if (features)
+        {
+            std::vector<color_t> denoised;
+            denoise(accumulation, *features, scheduler, denoised);
+            for (int32_t y = 0; y < image_height; ++y)
+            {
+                for (int32_t i = 0; i < image_width; ++i)
+                    output.pixel(i, y) = denoised[pixel_index(i, y)];
             }
+            output.complete(0, 0, image_width, image_height);
+        }
+
+        if (options.adaptive_threshold > 0)
+            report_sample_counts(accumulation);
+
+        // Only prints if built with ART_STATS
+        print_stats(stderr);
 
-            // Create the pixel.
-            image_data.push_back(create_pixel(pixel_color, samples_per_pixel));
+        bool const written = output.finish();
+        if (file != stdout)
+            std::fclose(file);
+
+        if (!written)
+        {
+            std::fprintf(stderr, "Failed to write the image\n");
+            return EXIT_FAILURE;
         }
+
+        return EXIT_SUCCESS;
     }
+}
 
-    //
-    // Write out PPM - https://wikipedia.org/wiki/Netpbm
-    //
-    std::printf("P3\n"
-                "%d %d\n"
-                "255\n", image_width, image_height);
-    for (auto const& p : image_data)
+int main(int argc, char* argv[])
+{
+    options_t options;
+    if (!parse_options(argc, argv, options))
     {
-        std::printf("%u %u %u\n", p.r, p.g, p.b);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    // Mixed precision renders in double over a world intersected in float.
+    if (options.precision == precision_t::single)
+        return render<float>(options);
+    return render<double>(options);
+}